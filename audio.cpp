@@ -0,0 +1,29 @@
+#include "audio.h"
+
+#include "flac.h"
+#include "wave.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+
+using std::ifstream;
+using std::ios;
+using std::string;
+using std::unique_ptr;
+
+unique_ptr<AudioReader> AudioReader::open(const string &fname)
+{
+    char magic[4] = { 0 };
+
+    if (fname != "-") {
+        ifstream in{ fname, ios::binary };
+        in.read(magic, sizeof(magic));
+    }
+
+    if (string(magic, 4) == "fLaC") {
+        return unique_ptr<AudioReader>{ new FlacReader{ fname } };
+    }
+
+    return unique_ptr<AudioReader>{ new WaveReader{ fname } };
+}
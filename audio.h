@@ -0,0 +1,31 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "stage.h"
+
+// A file of audio samples in one of the formats we can read.
+//
+class AudioReader : public SampleSource {
+public:
+    // Open `fname', choosing the reader by what's in the file. A name
+    // of `-' reads a wave file from stdin.
+    //
+    static std::unique_ptr<AudioReader> open(const std::string &fname);
+
+    virtual int getChannels() const = 0;
+    virtual bool isStreaming() const { return false; }
+    virtual uint32_t getSampleCount() const = 0;
+
+    virtual uint64_t hashData() = 0;
+
+    virtual void setReadChannel(int chan) = 0;
+    virtual void startReadAhead(int /*depth*/) {}
+
+    virtual double getIoWaitSeconds() const { return 0; }
+};
+
+#endif
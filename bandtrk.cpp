@@ -0,0 +1,86 @@
+#include "bandtrk.h"
+
+#include <algorithm>
+#include <cmath>
+
+using Value = SpanSource::Value;
+
+namespace {
+    const double MARK_FREQ = 2400.0;
+    const double SPACE_FREQ = 1200.0;
+
+    // Cycles within this far of the nominal frequencies (at the current
+    // speed) pull the speed estimate, even if they're outside the bands.
+    // The ranges don't overlap so a cycle is never counted as both.
+    //
+    const double CAPTURE = 0.25;
+
+    // How far the speed may drift from nominal
+    const double MIN_SPEED = 0.8;
+    const double MAX_SPEED = 1.25;
+
+    // Weight of each cycle in the moving average of the speed. At 1/256
+    // the estimate follows changes over about a tenth of a second of 
+    // signal.
+    //
+    const double ALPHA = 1.0 / 256;
+
+    // how far `f' is from the middle of the band from `lo' to `hi', as a
+    // fraction of half the band
+    double nearEdge(double f, double lo, double hi)
+    {
+        double mid = (lo + hi) / 2;
+        return std::abs(f - mid) / (mid - lo);
+    }
+}
+
+BandTracker::BandTracker()
+    : adapt_(false)
+    , speed_(1.0)
+    , clock_(1.0 / BAUD_RATE)
+    , edge_(0)
+{
+}
+
+// Enable tracking of tape speed
+void BandTracker::adapt()
+{
+    adapt_ = true;
+}
+
+// Classify one cycle with the given frequency. 
+//
+Value BandTracker::classify(double freq)
+{
+    double f = freq / speed_;
+
+    if (adapt_) {
+        double ratio = 0.0;
+
+        if (f > MARK_FREQ * (1 - CAPTURE) && f < MARK_FREQ * (1 + CAPTURE)) {
+            ratio = freq / MARK_FREQ;
+        } else if (f > SPACE_FREQ * (1 - CAPTURE) && f < SPACE_FREQ * (1 + CAPTURE)) {
+            ratio = freq / SPACE_FREQ;
+        }
+
+        if (ratio != 0.0) {
+            speed_ += (ratio - speed_) * ALPHA;
+            speed_ = std::max(MIN_SPEED, std::min(MAX_SPEED, speed_));
+            clock_ = 1.0 / (BAUD_RATE * speed_);
+        }
+    }
+
+    // The nominal frequencies are 1200/2400 hz, but things
+    // like tape speed, warble, and the waveform not being exactly 
+    // centered mean we need to look at ranges.
+    //
+    if (f > 2100 && f < 2550) {
+        edge_ = nearEdge(f, 2100, 2550);
+        return SpanSource::Mark;
+    } else if (f >= 1100 && f < 1550) {
+        edge_ = nearEdge(f, 1100, 1550);
+        return SpanSource::Space;
+    }
+
+    return SpanSource::Noise;
+}
@@ -0,0 +1,36 @@
+#ifndef BANDTRK_H
+#define BANDTRK_H
+
+#include "stage.h"
+
+// Classifies the frequency of each cycle as mark, space or noise. In
+// adaptive mode, it also tracks the actual mark and space frequencies
+// so that tapes played back too fast or too slow still land inside the
+// bands, and the bit clock follows along.
+//
+class BandTracker {
+public:
+    // the bit clock is given for this rate (see BaudFilter for others)
+    static const int BAUD_RATE = 300;
+
+    BandTracker();
+
+    void adapt();
+
+    SpanSource::Value classify(double freq);
+
+    double getSpeed() const { return speed_; }
+    double getClock() const { return clock_; }
+
+    // how near the last cycle classified as mark or space came to the
+    // edge of its band, from 0 in the middle to 1 at the edge
+    double getEdge() const { return edge_; }
+
+private:
+    bool adapt_;
+    double speed_;
+    double clock_;
+    double edge_;
+};
+
+#endif
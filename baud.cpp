@@ -0,0 +1,215 @@
+#include "baud.h"
+
+#include "bandtrk.h"
+#include "perfctr.h"
+
+#include <stdexcept>
+#include <vector>
+
+using std::runtime_error;
+using std::vector;
+
+namespace {
+    // Spans are measured in 1200 baud bits. At 300 baud every span of a
+    // character is at least four of them and at 600 baud at least two,
+    // so a record with many spans one or two long is at a higher rate.
+    // Spans longer than LONGEST are leader rather than characters.
+    //
+    const double LONGEST = 40.0;
+    const double SHARE = 0.2;
+
+    // A span of mark or space at least SOLID long is signal rather than
+    // a stray cycle or two of noise. GAP seconds without one ends a
+    // record.
+    //
+    const double SOLID = 1.5;
+    const double GAP = 1.0;
+
+    // How much of a record is looked at to work out its rate: this many
+    // spans, or this many seconds from the first one after the leader,
+    // whichever comes first. With fewer than MIN_SPANS, the rate isn't changed.
+    //
+    const int DETECT_SPANS = 256;
+    const double DETECT_SECONDS = 2.0;
+    const int MIN_SPANS = 16;
+}
+
+BaudFilter::BaudFilter(SpanSource &spans, int baud, int window)
+    : spans_(spans, window)
+    , flush_(false)
+    , detect_(baud == AUTO)
+    , baud_(baud == AUTO ? BandTracker::BAUD_RATE : baud)
+    , pendingIdx_(0)
+    , decided_(0)
+    , detecting_(false)
+    , heard_(false)
+    , firstData_(0)
+    , lastStart_(0)
+    , quiet_(0)
+{
+    if (baud != AUTO && baud != 300 && baud != 600 && baud != 1200) {
+        throw runtime_error{ "baud rate must be 300, 600 or 1200." };
+    }
+
+    if (detect_) {
+        startRecord();
+    } else {
+        records_.push_back(baud_);
+    }
+}
+
+// Return as soon as the buffered spans are used up, rather than
+// waiting for a full block
+void BaudFilter::flush()
+{
+    flush_ = true;
+}
+
+// Pass on spans with the bit clock set for the rate of the record they
+// are in
+vector<BaudFilter::Span> BaudFilter::getSpans(int nspans)
+{
+    PerfScope scope{ PerfCounters::Baud };
+
+    vector<Span> spans;
+
+    while (spans.size() < nspans) {
+        if (pendingIdx_ < decided_) {
+            spans.push_back(pending_[pendingIdx_++]);
+            continue;
+        }
+
+        if (flush_ && spans.size() && spans_.drained()) {
+            break;
+        }
+
+        Span span = spans_.next();
+        if (spans_.eof()) {
+            if (detecting_) {
+                decide();
+                continue;
+            }
+            break;
+        }
+
+        pending_.push_back(span);
+
+        if (!detect_) {
+            pending_.back().clock *= double(BandTracker::BAUD_RATE) / baud_;
+            decided_ = pending_.size();
+            continue;
+        }
+
+        bool solid = span.value != Noise && bits(span.length, span.clock) >= SOLID;
+        quiet_ = solid ? 0 : quiet_ + span.length;
+
+        if (detecting_) {
+            count(span);
+        } else {
+            pending_.back().clock *= double(BandTracker::BAUD_RATE) / baud_;
+            decided_ = pending_.size();
+        }
+
+        // a gap ends the record, unless it hasn't started yet
+        if (quiet_ >= GAP && (heard_ || !detecting_)) {
+            if (detecting_) {
+                decide();
+            }
+            startRecord();
+        }
+    }
+
+    if (pendingIdx_ == pending_.size()) {
+        pending_.clear();
+        pendingIdx_ = 0;
+        decided_ = 0;
+    }
+
+    return spans;
+}
+
+// A length in 1200 baud bits, given the bit clock of a span
+double BaudFilter::bits(double length, double clock)
+{
+    return length / (clock * BandTracker::BAUD_RATE / 1200.0);
+}
+
+// Start working out the rate of a new record
+void BaudFilter::startRecord()
+{
+    detecting_ = true;
+    heard_ = false;
+    firstData_ = -1;
+    lastStart_ = -1;
+    histogram_[0] = histogram_[1] = histogram_[2] = 0;
+}
+
+// Count a span towards working out the rate of the record, from its first
+// solid span on, and decide once enough of it has been seen. Each change
+// of tone leaves a cycle or so of noise which is taken off the spans both
+// sides, so a span is measured from its start to the start of the next.
+//
+void BaudFilter::count(const Span &span)
+{
+    if (span.value == Noise) {
+        return;
+    }
+
+    if (!heard_) {
+        if (bits(span.length, span.clock) < SOLID) {
+            return;
+        }
+        heard_ = true;
+    }
+
+    double last = lastStart_;
+    lastStart_ = span.start;
+
+    double len = bits(span.start - last, span.clock);
+    if (last < 0 || len < 0.5 || len >= LONGEST) {
+        return;
+    }
+
+    if (firstData_ < 0) {
+        firstData_ = span.start;
+    }
+
+    int n = int(len + 0.5);
+    histogram_[n < 3 ? n - 1 : 2]++;
+
+    int total = histogram_[0] + histogram_[1] + histogram_[2];
+    if (total >= DETECT_SPANS || span.start - firstData_ >= DETECT_SECONDS) {
+        decide();
+    }
+}
+
+// Settle the rate of the record from the spans counted so far, and set
+// the clock of the spans held back. Data at 1200 baud has plenty of
+// spans both one and two bits long; a tape at 300 baud with the tones
+// off frequency can have a lot of one bit spans of noise, but few of
+// two.
+//
+void BaudFilter::decide()
+{
+    int total = histogram_[0] + histogram_[1] + histogram_[2];
+
+    if (total >= MIN_SPANS) {
+        if (histogram_[0] >= total * SHARE && histogram_[1] >= total * SHARE) {
+            baud_ = 1200;
+        } else if (histogram_[1] >= total * SHARE) {
+            baud_ = 600;
+        } else {
+            baud_ = 300;
+        }
+    }
+
+    for (size_t i = decided_; i < pending_.size(); i++) {
+        pending_[i].clock *= double(BandTracker::BAUD_RATE) / baud_;
+    }
+    decided_ = pending_.size();
+
+    if (heard_) {
+        records_.push_back(baud_);
+    }
+    detecting_ = false;
+}
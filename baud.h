@@ -0,0 +1,60 @@
+#ifndef BAUD_H
+#define BAUD_H
+
+#include <vector>
+
+#include "blockrd.h"
+#include "stage.h"
+
+// Sets the bit clock of each span for tapes recorded at 600 or 1200 baud
+// rather than 300. The tones are the same at every rate, only the bits
+// are shorter, so nothing else in the chain needs to know the rate.
+//
+// The rate may be given, or worked out separately for each record on the
+// tape from how long its spans are. Records are separated by gaps of
+// noise or silence, and start with the first solid span of mark or space
+// after one. The spans of a record are held back until there are enough
+// to tell, then passed on with the clock set.
+//
+class BaudFilter : public SpanSource {
+public:
+    // a rate to work out from the tape
+    static const int AUTO = 0;
+
+    BaudFilter(SpanSource &spans, int baud, int window = 1024);
+
+    void flush();
+    std::vector<Span> getSpans(int nspans) override;
+
+    // the rate of each record so far, in order
+    const std::vector<int> &getRecordBauds() const { return records_; }
+
+private:
+    BlockReader<SpanSource> spans_;
+    bool flush_;
+    bool detect_;
+    int baud_;
+
+    // spans read but not yet returned; those before decided_ have their
+    // clock set
+    std::vector<Span> pending_;
+    size_t pendingIdx_;
+    size_t decided_;
+
+    // the record whose rate is being worked out, and how long it's been
+    // since the last solid span
+    bool detecting_;
+    bool heard_;
+    double firstData_;
+    double lastStart_;
+    int histogram_[3];
+    double quiet_;
+    std::vector<int> records_;
+
+    static double bits(double length, double clock);
+    void startRecord();
+    void count(const Span &span);
+    void decide();
+};
+
+#endif
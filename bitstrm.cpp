@@ -1,44 +1,99 @@
 #include "bitstrm.h"
 
+#include "perfctr.h"
+#include "probes.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cmath>
 #include <cstdlib>
-#include <iostream>
 #include <vector>
 
-using std::cout;
-using std::endl;
 using std::vector;
 
-BitstreamFilter::BitstreamFilter(DeNoiseFilter &dn)
-    : dn_(dn)
-    , spanIdx_(0)
-    , eof_(false)
-    , trace_(false)
+namespace {
+    // Loop gains for clock recovery. Each transition moves the phase by
+    // PHASE_GAIN of its error, and the period by PERIOD_GAIN of it.
+    //
+    const double PHASE_GAIN = 0.4;
+    const double PERIOD_GAIN = 0.02;
+
+    // How far the recovered clock may drift from the span's bit clock
+    const double MAX_DRIFT = 0.1;
+
+    // The loop is locked when the average phase error at transitions,
+    // as a fraction of a bit, is below LOCK_ERROR.
+    //
+    const double LOCK_ALPHA = 1.0 / 16;
+    const double LOCK_ERROR = 0.1;
+}
+
+BitstreamFilter::BitstreamFilter(SpanSource &dn, int window)
+    : spans_(dn, window)
+    , trace_(nullptr)
+    , flush_(false)
+    , pll_(false)
+    , locked_(false)
+    , period_(0)
+    , nextSample_(0)
+    , phaseError_(0.5)
+    , lockedBits_(0)
+    , bitCount_(0)
 {
-    spans_ = dn_.getSpans(WINDOW);
-    span_ = getNextSpan();
+    span_ = spans_.next();
+    startSpan();
 }
 
 // turn on tracing
-void BitstreamFilter::trace()
+void BitstreamFilter::trace(TraceRing &ring)
+{
+    trace_ = &ring;
+}
+
+// Return as soon as the buffered spans are used up, rather than
+// waiting for a full block of bits
+void BitstreamFilter::flush()
 {
-    trace_ = true;
+    flush_ = true;
+}
+
+// Recover the bit clock from the transitions in the signal rather than
+// counting whole clocks in each span.
+void BitstreamFilter::recoverClock()
+{
+    pll_ = true;
+    period_ = span_.clock;
+    nextSample_ = span_.start + period_ / 2;
 }
 
 // Expand spans into individual bits
 vector<bool> BitstreamFilter::getBits(int nbits)
 {
+    PerfScope scope{ PerfCounters::Bitstream };
+    OSIWAVE_PROBE1(bits_entry, nbits);
+
     vector<bool> bits;
+    bitTimes_.clear();
+    bitEvidence_.clear();
 
-    if (trace_) {
-      cout << "bits: ";
+    if (pll_) {
+        getRecoveredBits(bits, nbits);
     }
 
-    while (bits.size() < nbits && !eof_) {
-        while (span_.clocks == 0 && !eof_) {
-            span_ = getNextSpan();
+    while (!pll_ && bits.size() < nbits && !spans_.eof()) {
+        while (span_.clocks == 0 && !spans_.eof()) {
+            if (flush_ && bits.size() && spans_.drained()) {
+                break;
+            }
+            span_ = spans_.next();
+            startSpan();
+        }
+
+        if (span_.clocks == 0 && !spans_.eof()) {
+            break;
         }
 
-        if (eof_) {
+        if (spans_.eof()) {
           break;
         }
 
@@ -47,38 +102,85 @@ vector<bool> BitstreamFilter::getBits(int nbits)
         }
 
         if (trace_) {
-            cout << (span_.value == FreqSpanFilter::Mark);
+            trace_->record(TraceEvent::Bit, bitTime_, span_.value == SpanSource::Mark);
         }
-        bits.push_back(span_.value == FreqSpanFilter::Mark);
+        bits.push_back(span_.value == SpanSource::Mark);
+        bitTimes_.push_back(bitTime_);
+        bitEvidence_.push_back(span_.evidence);
+        bitTime_ += bitLength_;
         span_.clocks--;
     }
 
-    if (trace_) {
-        cout << endl;
-    }
+    bitCount_ += bits.size();
 
+    OSIWAVE_PROBE2(bits_return, nbits, bits.size());
     return bits;
 }
 
-// Get the next buffered span.
-BitstreamFilter::Span BitstreamFilter::getNextSpan()
+// Sample the spans at the middle of each bit, as given by a digital PLL 
+// which is pulled towards the transitions between spans.
+//
+void BitstreamFilter::getRecoveredBits(vector<bool> &bits, int nbits)
 {
-    if (eof_) {
-        return Span{};
-    }
+    while (bits.size() < nbits && !spans_.eof()) {
+        double spanEnd = span_.start + span_.length;
+
+        if (nextSample_ < spanEnd) {
+            bool bit = span_.value == SpanSource::Mark;
+            bits.push_back(bit);
+            bitTimes_.push_back(nextSample_ - period_ / 2);
+            bitEvidence_.push_back(span_.evidence);
+            if (trace_) {
+                trace_->record(TraceEvent::Bit, bitTimes_.back(), bit);
+            }
+            if (locked_) {
+                lockedBits_++;
+            }
+            nextSample_ += period_;
+            continue;
+        }
 
-    if (spanIdx_ < spans_.size()) {
-        Span span = spans_[spanIdx_++];
-        return span;
-    }
+        if (flush_ && bits.size() && spans_.drained()) {
+            break;
+        }
 
-    spans_ = dn_.getSpans(WINDOW);
-    spanIdx_ = 0;
+        Span next = spans_.next();
+        if (spans_.eof()) {
+            break;
+        }
 
-    if (spans_.size() == 0) {
-        eof_ = true;
-        return Span{};
+        if (next.value != span_.value) {
+            trackEdge(spanEnd);
+        }
+
+        span_ = next;
     }
+}
+
+// Adjust the clock for a transition at time `edge'. Transitions should 
+// fall halfway between sampling instants.
+//
+void BitstreamFilter::trackEdge(double edge)
+{
+    double expected = nextSample_ - period_ / 2;
+    double error = edge - expected;
+
+    // the nearest expected edge might be one bit earlier
+    error -= period_ * std::floor(error / period_ + 0.5);
+
+    nextSample_ += PHASE_GAIN * error;
+    period_ += PERIOD_GAIN * error;
+
+    double nominal = span_.clock;
+    period_ = std::max(nominal * (1 - MAX_DRIFT), std::min(nominal * (1 + MAX_DRIFT), period_));
 
-    return getNextSpan();
+    phaseError_ += (std::abs(error) / period_ - phaseError_) * LOCK_ALPHA;
+    locked_ = phaseError_ < LOCK_ERROR;
+}
+
+// Set up to expand the current span into bits
+void BitstreamFilter::startSpan()
+{
+    bitTime_ = span_.start;
+    bitLength_ = span_.clocks ? span_.length / span_.clocks : 0;
 }
@@ -1,28 +1,50 @@
 #ifndef BITSTRM_H
 #define BITSTRM_H
 
-#include "denoise.h"
+#include "blockrd.h"
+#include "stage.h"
 
-class BitstreamFilter {
+class TraceRing;
+
+class BitstreamFilter : public BitSource {
 public:
-    using Span = DeNoiseFilter::Span;
-    BitstreamFilter(DeNoiseFilter &dn);
+    using Span = SpanSource::Span;
+    BitstreamFilter(SpanSource &dn, int window = 1024);
+
+    void trace(TraceRing &ring);
+    void flush();
+    void recoverClock();
+    std::vector<bool> getBits(int nbits) override;
+    std::vector<double> getBitTimes() const override { return bitTimes_; }
+    std::vector<SpanSource::Evidence> getBitEvidence() const override { return bitEvidence_; }
 
-    void trace();
-    std::vector<bool> getBits(int nbits);
+    bool isLocked() const { return locked_; }
+    uint64_t getLockedBits() const { return lockedBits_; }
+    uint64_t getBitCount() const { return bitCount_; }
     
 private:
-    const int WINDOW = 1024;
-    
-    DeNoiseFilter &dn_;
-    std::vector<Span> spans_;
-    int spanIdx_;
-    bool eof_;
-    bool trace_;
+    BlockReader<SpanSource> spans_;
+    TraceRing *trace_;
+    bool flush_;
 
     Span span_;
+    double bitTime_;
+    double bitLength_;
+    std::vector<double> bitTimes_;
+    std::vector<SpanSource::Evidence> bitEvidence_;
+
+    // clock recovery state
+    bool pll_;
+    bool locked_;
+    double period_;
+    double nextSample_;
+    double phaseError_;
+    uint64_t lockedBits_;
+    uint64_t bitCount_;
     
-    Span getNextSpan();
+    void startSpan();
+    void getRecoveredBits(std::vector<bool> &bits, int nbits);
+    void trackEdge(double edge);
 };
 
 #endif
@@ -0,0 +1,103 @@
+#ifndef BLOCKRD_H
+#define BLOCKRD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "dcfilter.h"
+#include "stage.h"
+
+// A bit and the time it started, and the evidence behind it, if the
+// source knows them
+struct TimedBit {
+    bool bit;
+    double time;
+    SpanSource::Evidence evidence;
+};
+
+// How a block is fetched from each kind of stage
+inline std::vector<int16_t> fetchBlock(SampleSource &src, int n) { return src.readSamples(n); }
+inline std::vector<int16_t> fetchBlock(DCFilter &src, int n) { return src.readSamples(n); }
+inline std::vector<double> fetchBlock(CrossingSource &src, int n) { return src.getTimestamps(n); }
+inline std::vector<SpanSource::Span> fetchBlock(SpanSource &src, int n) { return src.getSpans(n); }
+
+inline std::vector<TimedBit> fetchBlock(BitSource &src, int n)
+{
+    std::vector<bool> bits = src.getBits(n);
+    std::vector<double> times = src.getBitTimes();
+    std::vector<SpanSource::Evidence> evidence = src.getBitEvidence();
+
+    std::vector<TimedBit> out(bits.size());
+    for (size_t i = 0; i < bits.size(); i++) {
+        out[i].bit = bits[i];
+        out[i].time = i < times.size() ? times[i] : 0.0;
+        out[i].evidence = i < evidence.size() ? evidence[i] : SpanSource::Evidence{};
+    }
+    return out;
+}
+
+// Reads what the stage before hands out in blocks, either one item at a
+// time or a whole block at a time. refill() is the only place a block
+// is fetched, so the per-item path is just an index into the block and
+// loops over the block can run without checking for more.
+//
+template <typename Source>
+class BlockReader {
+public:
+    using Block = decltype(fetchBlock(std::declval<Source &>(), 0));
+    using Item = typename Block::value_type;
+
+    BlockReader(Source &src, int window)
+        : src_(src)
+        , window_(window)
+        , idx_(0)
+        , eof_(false)
+    {
+    }
+
+    // The next item, or a default one once the source is at end of file
+    Item next()
+    {
+        if (idx_ == block_.size() && !refill()) {
+            return Item{};
+        }
+        return block_[idx_++];
+    }
+
+    // Fetch the next block; false at end of file. Anything left of the
+    // current block is dropped.
+    //
+    bool refill()
+    {
+        if (eof_) {
+            return false;
+        }
+
+        block_ = fetchBlock(src_, window_);
+        idx_ = 0;
+
+        eof_ = block_.empty();
+        return !eof_;
+    }
+
+    bool eof() const { return eof_; }
+
+    // has everything fetched so far been used?
+    bool drained() const { return idx_ == block_.size(); }
+
+    // The unused part of the current block, and how to use some of it
+    const Item *begin() const { return block_.data() + idx_; }
+    const Item *end() const { return block_.data() + block_.size(); }
+    void consume(size_t n) { idx_ += n; }
+
+private:
+    Source &src_;
+    int window_;
+    Block block_;
+    size_t idx_;
+    bool eof_;
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include "cache.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using std::ifstream;
+using std::ios;
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace {
+    const char MAGIC[] = "OSWC";
+    const uint32_t VERSION = 1;
+    const char SUFFIX[] = ".osc";
+
+    void writeWord(ofstream &out, uint64_t w, int nbytes)
+    {
+        for (int i = 0; i < nbytes; i++) {
+            out.put(static_cast<char>(w & 0xff));
+            w >>= 8;
+        }
+    }
+
+    bool readWord(ifstream &in, uint64_t &w, int nbytes)
+    {
+        char bytes[8];
+
+        if (!in.read(bytes, nbytes)) {
+            return false;
+        }
+
+        w = 0;
+        for (int i = nbytes-1; i >= 0; i--) {
+            w = (w << 8) | static_cast<uint8_t>(bytes[i]);
+        }
+        return true;
+    }
+
+    void writeString(ofstream &out, const string &s)
+    {
+        writeWord(out, s.size(), 8);
+        out.write(s.data(), s.size());
+    }
+
+    bool readString(ifstream &in, string &s)
+    {
+        uint64_t len;
+        if (!readWord(in, len, 8)) {
+            return false;
+        }
+
+        s.resize(len);
+        return len == 0 || in.read(&s[0], len);
+    }
+
+    // Holds an flock on a file for the lifetime of the object
+    class DirLock {
+    public:
+        DirLock(const string &path)
+        {
+            fd_ = open(path.c_str(), O_RDWR|O_CREAT, 0666);
+            if (fd_ != -1) {
+                flock(fd_, LOCK_EX);
+            }
+        }
+
+        ~DirLock()
+        {
+            if (fd_ != -1) {
+                flock(fd_, LOCK_UN);
+                close(fd_);
+            }
+        }
+
+    private:
+        int fd_;
+    };
+}
+
+DecodeCache::DecodeCache(const string &dir, uint64_t maxBytes)
+    : dir_(dir)
+    , maxBytes_(maxBytes)
+{
+    if (mkdir(dir_.c_str(), 0777) == -1 && errno != EEXIST) {
+        throw runtime_error{ "cannot create cache directory " + dir_ + "." };
+    }
+}
+
+// Look up a previous decode of the same data with the same parameters.
+// On a hit, fills in `output' and `stats' and marks the entry as
+// recently used.
+//
+bool DecodeCache::lookup(uint64_t dataHash, const string &params, string &output, string &stats)
+{
+    string path = entryPath(dataHash, params);
+
+    ifstream in{ path, ios::binary };
+    if (!in) {
+        return false;
+    }
+
+    char magic[4];
+    uint64_t version;
+    uint64_t hash;
+    string storedParams;
+
+    if (!in.read(magic, 4) || string(magic, 4) != MAGIC ||
+        !readWord(in, version, 4) || version != VERSION ||
+        !readWord(in, hash, 8) || hash != dataHash ||
+        !readString(in, storedParams) || storedParams != params ||
+        !readString(in, output) || 
+        !readString(in, stats)) {
+        return false;
+    }
+
+    // the file's modification time is the LRU timestamp
+    utimes(path.c_str(), nullptr);
+
+    return true;
+}
+
+// Store the results of a decode. The entry is written to a temporary file
+// and renamed into place so readers never see a partial entry.
+//
+void DecodeCache::store(uint64_t dataHash, const string &params, const string &output, const string &stats)
+{
+    string path = entryPath(dataHash, params);
+
+    stringstream ss;
+    ss << path << ".tmp." << getpid();
+    string tmp = ss.str();
+
+    {
+        ofstream out{ tmp, ios::binary|ios::trunc };
+        out.write(MAGIC, 4);
+        writeWord(out, VERSION, 4);
+        writeWord(out, dataHash, 8);
+        writeString(out, params);
+        writeString(out, output);
+        writeString(out, stats);
+
+        if (!out) {
+            unlink(tmp.c_str());
+            throw runtime_error{ "failed writing cache entry " + tmp + "." };
+        }
+    }
+
+    if (rename(tmp.c_str(), path.c_str()) == -1) {
+        unlink(tmp.c_str());
+        throw runtime_error{ "failed writing cache entry " + path + "." };
+    }
+
+    evict();
+}
+
+// The entry file name is a hash of both the data and the parameters
+//
+string DecodeCache::entryPath(uint64_t dataHash, const string &params) const
+{
+    Hash64 hash{ dataHash };
+    hash.update(params.data(), params.size());
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash.digest()));
+
+    return dir_ + "/" + name + SUFFIX;
+}
+
+// Remove least recently used entries until the cache fits in its size
+// limit. This is serialized across processes with a lock file so two
+// workers don't both evict down past the limit.
+//
+void DecodeCache::evict()
+{
+    struct Entry {
+        string path;
+        time_t mtime;
+        uint64_t size;
+    };
+
+    DirLock lock{ dir_ + "/lock" };
+
+    DIR *dir = opendir(dir_.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    vector<Entry> entries;
+    uint64_t total = 0;
+    const size_t suffixLen = sizeof(SUFFIX) - 1;
+
+    while (struct dirent *de = readdir(dir)) {
+        string name = de->d_name;
+        if (name.size() <= suffixLen || name.compare(name.size() - suffixLen, suffixLen, SUFFIX) != 0) {
+            continue;
+        }
+
+        string path = dir_ + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1) {
+            continue;
+        }
+
+        entries.push_back(Entry{ path, st.st_mtime, static_cast<uint64_t>(st.st_size) });
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (total <= maxBytes_) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.mtime < b.mtime;
+    });
+
+    for (const Entry &e : entries) {
+        if (total <= maxBytes_) {
+            break;
+        }
+        if (unlink(e.path.c_str()) == 0) {
+            total -= e.size;
+        }
+    }
+}
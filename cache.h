@@ -0,0 +1,27 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdint>
+#include <string>
+
+// An on-disk cache of decode results, keyed by a hash of the wave data
+// and the decode parameters. Entries are evicted least recently used
+// first once the cache grows past its size limit. Several processes may
+// share one cache directory.
+//
+class DecodeCache {
+public:
+    DecodeCache(const std::string &dir, uint64_t maxBytes);
+
+    bool lookup(uint64_t dataHash, const std::string &params, std::string &output, std::string &stats);
+    void store(uint64_t dataHash, const std::string &params, const std::string &output, const std::string &stats);
+
+private:
+    std::string dir_;
+    uint64_t maxBytes_;
+
+    std::string entryPath(uint64_t dataHash, const std::string &params) const;
+    void evict();
+};
+
+#endif
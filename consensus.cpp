@@ -0,0 +1,369 @@
+#include "consensus.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::map;
+using std::pair;
+using std::string;
+using std::thread;
+using std::unordered_map;
+using std::vector;
+
+namespace {
+    // Characters are aligned within this many positions either side of
+    // where the anchors say they should be.
+    //
+    const int BAND = 64;
+
+    // Length of the runs of characters used as anchors
+    const int ANCHOR = 8;
+
+    // A capture whose edit distance from the reference is more than this
+    // share of the reference's length hasn't really been lined up with it,
+    // and doesn't vote.
+    //
+    const double MAX_COST = 0.25;
+
+    // traceback directions
+    const uint8_t DIAG = 0;
+    const uint8_t UP = 1;       // reference character with nothing matching
+    const uint8_t LEFT = 2;     // extra character in the other capture
+
+    const int INF = std::numeric_limits<int>::max() / 2;
+}
+
+Consensus::Consensus(const vector<Capture> &captures)
+    : captures_(captures)
+    , ref_(0)
+{
+}
+
+// Align every capture to the reference, each in its own thread, and vote
+void Consensus::run()
+{
+    int ncaptures = captures_.size();
+
+    for (int i = 1; i < ncaptures; i++) {
+        if (captures_[i].chars.size() > captures_[ref_].chars.size()) {
+            ref_ = i;
+        }
+    }
+
+    alignments_.resize(ncaptures);
+
+    vector<thread> threads;
+    for (int i = 0; i < ncaptures; i++) {
+        if (i != ref_) {
+            threads.emplace_back([this, i]() { align(captures_[i], alignments_[i]); });
+        }
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    vote();
+}
+
+// Find the minimum edit distance alignment of `other' to the reference,
+// only looking at a band around the expected path through the table so
+// long captures don't need a huge amount of memory.
+//
+void Consensus::align(const Capture &other, Alignment &alignment)
+{
+    const string &a = captures_[ref_].chars;
+    const string &b = other.chars;
+    int n = a.size();
+    int m = b.size();
+
+    // the band of `other' characters considered for each row; each row
+    // has to overlap the one before so there's always a path through
+    vector<int> center = bandCenters(other);
+    vector<int> lo(n + 1);
+    vector<int> hi(n + 1);
+
+    for (int i = 0; i <= n; i++) {
+        lo[i] = std::max(0, center[i] - BAND);
+        hi[i] = std::min(m, center[i] + BAND);
+        if (i) {
+            lo[i] = std::min(lo[i], hi[i - 1]);
+            hi[i] = std::max(hi[i], lo[i - 1]);
+        }
+    }
+    lo[0] = 0;
+    hi[n] = m;
+    for (int i = n; i > 0; i--) {
+        hi[i - 1] = std::max(hi[i - 1], lo[i]);
+    }
+
+    vector<size_t> rowStart(n + 2);
+    for (int i = 0; i <= n; i++) {
+        rowStart[i + 1] = rowStart[i] + hi[i] - lo[i] + 1;
+    }
+
+    vector<uint8_t> dir(rowStart[n + 1]);
+    vector<int> prev;
+    vector<int> curr;
+
+    auto cost = [&](const vector<int> &row, int i, int j) {
+        return (j < lo[i] || j > hi[i]) ? INF : row[j - lo[i]];
+    };
+
+    for (int i = 0; i <= n; i++) {
+        curr.assign(hi[i] - lo[i] + 1, INF);
+
+        for (int j = lo[i]; j <= hi[i]; j++) {
+            int best = INF;
+            uint8_t d = DIAG;
+
+            if (i == 0 && j == 0) {
+                best = 0;
+            }
+            if (i && j) {
+                int c = cost(prev, i - 1, j - 1) + (a[i - 1] != b[j - 1]);
+                if (c < best) {
+                    best = c;
+                    d = DIAG;
+                }
+            }
+            if (i) {
+                int c = cost(prev, i - 1, j) + 1;
+                if (c < best) {
+                    best = c;
+                    d = UP;
+                }
+            }
+            if (j > lo[i]) {
+                int c = curr[j - 1 - lo[i]] + 1;
+                if (c < best) {
+                    best = c;
+                    d = LEFT;
+                }
+            }
+
+            curr[j - lo[i]] = best;
+            dir[rowStart[i] + j - lo[i]] = d;
+        }
+
+        std::swap(prev, curr);
+    }
+
+    alignment.cost = prev[m - lo[n]];
+    alignment.voting = alignment.cost <= MAX_COST * n;
+
+    alignment.chars.assign(n, -1);
+    alignment.inserts.assign(n + 1, string{});
+
+    int i = n;
+    int j = m;
+    while (i || j) {
+        uint8_t d = dir[rowStart[i] + j - lo[i]];
+        if (d == DIAG && i && j) {
+            alignment.chars[i - 1] = static_cast<uint8_t>(b[j - 1]);
+            i--;
+            j--;
+        } else if (d == UP && i) {
+            i--;
+        } else {
+            alignment.inserts[i].insert(alignment.inserts[i].begin(), b[j - 1]);
+            j--;
+        }
+    }
+}
+
+// For each row of the alignment table, where in `other' the reference's
+// characters are expected to be. Runs of characters which appear once in
+// each capture anchor the alignment, and in between the anchors the 
+// position is interpolated. In repeated text the same damage in two
+// different lines can look like an anchor, so one is only trusted if it
+// is within the band of where the estimate below puts it.
+//
+vector<int> Consensus::bandCenters(const Capture &other)
+{
+    const Capture &ref = captures_[ref_];
+    const string &a = ref.chars;
+    const string &b = other.chars;
+    int n = a.size();
+    int m = b.size();
+
+    // find the runs which are unique in both
+    auto unique = [](const string &s) {
+        unordered_map<string, int> pos;
+        for (int i = 0; i + ANCHOR <= int(s.size()); i++) {
+            auto it = pos.emplace(s.substr(i, ANCHOR), i);
+            if (!it.second) {
+                it.first->second = -1;
+            }
+        }
+        return pos;
+    };
+
+    auto refRuns = unique(a);
+    auto otherRuns = unique(b);
+    vector<int> estimate = estimateCenters(other);
+
+    vector<pair<int, int>> pairs;
+    for (auto &run : refRuns) {
+        if (run.second == -1) {
+            continue;
+        }
+        auto it = otherRuns.find(run.first);
+        if (it != otherRuns.end() && it->second != -1 && std::abs(it->second - estimate[run.second]) <= BAND) {
+            pairs.push_back({ run.second, it->second });
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    // Keep the longest run of anchors which are in order in both, so one
+    // repeated bit of text can't pull the alignment out of place.
+    //
+    vector<int> tails;
+    vector<int> tailIdx;
+    vector<int> back(pairs.size(), -1);
+    for (size_t k = 0; k < pairs.size(); k++) {
+        auto it = std::lower_bound(tails.begin(), tails.end(), pairs[k].second);
+        size_t len = it - tails.begin();
+        if (len) {
+            back[k] = tailIdx[len - 1];
+        }
+        if (it == tails.end()) {
+            tails.push_back(pairs[k].second);
+            tailIdx.push_back(k);
+        } else {
+            *it = pairs[k].second;
+            tailIdx[len] = k;
+        }
+    }
+
+    vector<pair<int, int>> anchors;
+    for (int k = tailIdx.empty() ? -1 : tailIdx.back(); k != -1; k = back[k]) {
+        anchors.push_back(pairs[k]);
+    }
+    std::reverse(anchors.begin(), anchors.end());
+
+    if (anchors.empty()) {
+        return estimate;
+    }
+
+    vector<int> center(n + 1);
+
+    size_t k = 0;
+    for (int i = 0; i <= n; i++) {
+        while (k + 1 < anchors.size() && anchors[k + 1].first <= i) {
+            k++;
+        }
+
+        int c;
+        if (i < anchors[k].first || k + 1 == anchors.size()) {
+            c = anchors[k].second + (i - anchors[k].first);
+        } else {
+            auto &a0 = anchors[k];
+            auto &a1 = anchors[k + 1];
+            c = a0.second + int(int64_t(i - a0.first) * (a1.second - a0.second) / (a1.first - a0.first));
+        }
+        center[i] = std::max(0, std::min(m, c));
+    }
+
+    return center;
+}
+
+// Where the reference's characters are expected to be in `other' without
+// anchors: by the character times, measured from the first character,
+// or if there are no times, in proportion to the lengths
+//
+vector<int> Consensus::estimateCenters(const Capture &other)
+{
+    const Capture &ref = captures_[ref_];
+    int n = ref.chars.size();
+    int m = other.chars.size();
+    bool timed = ref.times.size() == ref.chars.size() && other.times.size() == other.chars.size() && n && m;
+
+    vector<int> center(n + 1);
+    for (int i = 0; i <= n; i++) {
+        if (timed) {
+            double t = ref.times[std::min(i, n - 1)] - ref.times[0] + other.times[0];
+            center[i] = std::lower_bound(other.times.begin(), other.times.end(), t) - other.times.begin();
+        } else {
+            center[i] = n ? int(int64_t(i) * m / n) : 0;
+        }
+    }
+    return center;
+}
+
+// Build the output. For each character of the reference, and for each
+// place some captures have extra characters the reference doesn't, take
+// whatever most of the voting captures have. Ties go to the reference.
+//
+void Consensus::vote()
+{
+    const Capture &ref = captures_[ref_];
+    int n = ref.chars.size();
+    int ncaptures = captures_.size();
+
+    int voters = 1;
+    for (int k = 0; k < ncaptures; k++) {
+        if (k != ref_ && alignments_[k].voting) {
+            voters++;
+        }
+    }
+
+    auto timeAt = [&](int i) {
+        return i < int(ref.times.size()) ? ref.times[i] : 0.0;
+    };
+
+    for (int i = 0; i <= n; i++) {
+        // the reference has nothing inserted here
+        map<string, int> inserts;
+        for (int k = 0; k < ncaptures; k++) {
+            if (k != ref_ && alignments_[k].voting && !alignments_[k].inserts[i].empty()) {
+                inserts[alignments_[k].inserts[i]]++;
+            }
+        }
+
+        for (auto &insert : inserts) {
+            if (insert.second * 2 > voters) {
+                for (char ch : insert.first) {
+                    chars_.push_back(ch);
+                    agreement_.push_back(insert.second);
+                    times_.push_back(timeAt(i));
+                }
+            }
+        }
+
+        if (i == n) {
+            break;
+        }
+
+        // -1 is a vote for the reference having an extra character here
+        map<int, int> votes;
+        int refChar = static_cast<uint8_t>(ref.chars[i]);
+        votes[refChar]++;
+        for (int k = 0; k < ncaptures; k++) {
+            if (k != ref_ && alignments_[k].voting) {
+                votes[alignments_[k].chars[i]]++;
+            }
+        }
+
+        int best = refChar;
+        for (auto &vote : votes) {
+            if (vote.second > votes[best]) {
+                best = vote.first;
+            }
+        }
+
+        if (best != -1) {
+            chars_.push_back(char(best));
+            agreement_.push_back(votes[best]);
+            times_.push_back(timeAt(i));
+        }
+    }
+}
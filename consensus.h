@@ -0,0 +1,67 @@
+#ifndef CONSENSUS_H
+#define CONSENSUS_H
+
+#include <string>
+#include <vector>
+
+// Combines the decodes of several captures of the same tape into one by
+// majority vote. Every capture is aligned against a reference capture 
+// (the one with the most characters) and each character of the output 
+// is the one most captures agree on at that point. A capture which can't
+// be lined up with the reference at all is left out of the vote, so the
+// output is never much worse than the reference.
+//
+class Consensus {
+public:
+    // one decoded capture; `times' is the start time of each character
+    // in seconds, or empty if not known
+    struct Capture {
+        std::string chars;
+        std::vector<double> times;
+    };
+
+    Consensus(const std::vector<Capture> &captures);
+
+    void run();
+
+    int getReference() const { return ref_; }
+    const std::string &getChars() const { return chars_; }
+
+    // For each output character, how many captures agreed on it and its
+    // time in the reference capture
+    const std::vector<int> &getAgreement() const { return agreement_; }
+    const std::vector<double> &getTimes() const { return times_; }
+
+    // The edit distance of a capture from the reference, and whether it
+    // was close enough to vote
+    int getCost(int capture) const { return alignments_[capture].cost; }
+    bool isVoting(int capture) const { return alignments_[capture].voting; }
+
+private:
+    // How a capture lines up with the reference. `chars[i]' is the 
+    // character matched to reference character i, or -1 if there is 
+    // none, and `inserts[i]' is what the capture has before reference 
+    // character i that the reference doesn't have.
+    //
+    struct Alignment {
+        std::vector<int> chars;
+        std::vector<std::string> inserts;
+        int cost = 0;
+        bool voting = true;
+    };
+
+    const std::vector<Capture> &captures_;
+    int ref_;
+    std::vector<Alignment> alignments_;
+
+    std::string chars_;
+    std::vector<int> agreement_;
+    std::vector<double> times_;
+
+    void align(const Capture &other, Alignment &alignment);
+    std::vector<int> bandCenters(const Capture &other);
+    std::vector<int> estimateCenters(const Capture &other);
+    void vote();
+};
+
+#endif
@@ -0,0 +1,395 @@
+#include "daemon.h"
+
+#include "audio.h"
+#include "baud.h"
+#include "memsrc.h"
+#include "perfctr.h"
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::condition_variable;
+using std::endl;
+using std::exception;
+using std::mutex;
+using std::runtime_error;
+using std::string;
+using std::stringstream;
+using std::thread;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+    // longest request line accepted
+    const size_t MAX_REQUEST = 4096;
+
+    // most samples accepted in one job, an hour at 44.1 kHz
+    const uint64_t MAX_SAMPLES = 3600ull * 44100;
+
+    // Read from `fd' until there's a whole line in `pending'. Returns the
+    // line without the newline, leaving whatever follows it in `pending'.
+    //
+    string readLine(int fd, string &pending)
+    {
+        char buf[1024];
+        size_t eol;
+
+        while ((eol = pending.find('\n')) == string::npos) {
+            if (pending.size() > MAX_REQUEST) {
+                throw runtime_error{ "request too long" };
+            }
+
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                throw runtime_error{ "connection closed" };
+            }
+            pending.append(buf, n);
+        }
+
+        string line = pending.substr(0, eol);
+        pending.erase(0, eol + 1);
+        return line;
+    }
+
+    // Read exactly `nbytes' into `buf', starting with whatever is pending
+    void readExact(int fd, char *buf, size_t nbytes, string &pending)
+    {
+        size_t done = std::min(nbytes, pending.size());
+        memcpy(buf, pending.data(), done);
+        pending.erase(0, done);
+
+        while (done < nbytes) {
+            ssize_t n = read(fd, buf + done, nbytes - done);
+            if (n <= 0) {
+                throw runtime_error{ "connection closed" };
+            }
+            done += n;
+        }
+    }
+
+    // Write all of `data', ignoring a client which has gone away
+    void writeAll(int fd, const string &data)
+    {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return;
+            }
+            done += n;
+        }
+    }
+
+    bool isSocket(const char *path)
+    {
+        struct stat st;
+        return lstat(path, &st) == 0 && S_ISSOCK(st.st_mode);
+    }
+
+    // Clear the way to bind to `addr'. Whatever is there must be a socket
+    // left over from a daemon which has gone; anything else, or a socket
+    // a daemon still answers on, is left alone.
+    //
+    void removeStale(const sockaddr_un &addr)
+    {
+        struct stat st;
+        if (lstat(addr.sun_path, &st) == -1) {
+            if (errno == ENOENT) {
+                return;
+            }
+            throw runtime_error{ string{ "cannot check socket: " } + strerror(errno) + "." };
+        }
+        if (!S_ISSOCK(st.st_mode)) {
+            throw runtime_error{ "not a socket." };
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) {
+            throw runtime_error{ string{ "cannot create socket: " } + strerror(errno) + "." };
+        }
+        bool live = connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0;
+        close(fd);
+        if (live) {
+            throw runtime_error{ "a daemon is already running on it." };
+        }
+
+        unlink(addr.sun_path);
+    }
+}
+
+DecodeDaemon::DecodeDaemon(const string &path, int workers, const DecodeOptions &opts, bool perfCounters)
+    : path_(path)
+    , workers_(workers)
+    , opts_(opts)
+    , perfCounters_(perfCounters)
+    , listenFd_(-1)
+    , maxQueue_(2 * workers)
+    , stopping_(false)
+{
+    // find out now rather than on the first job if counting won't work
+    if (perfCounters_) {
+        PerfCounters check;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        throw runtime_error{ "socket path too long." };
+    }
+    strcpy(addr.sun_path, path_.c_str());
+
+    // a socket left over from a previous run would make bind fail
+    removeStale(addr);
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd_ == -1) {
+        throw runtime_error{ string{ "cannot create socket: " } + strerror(errno) + "." };
+    }
+
+    if (bind(listenFd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 || listen(listenFd_, 64) == -1) {
+        string err = strerror(errno);
+        close(listenFd_);
+        throw runtime_error{ "cannot listen on socket: " + err + "." };
+    }
+}
+
+DecodeDaemon::~DecodeDaemon()
+{
+    stop();
+
+    if (listenFd_ != -1) {
+        close(listenFd_);
+        if (isSocket(path_.c_str())) {
+            unlink(path_.c_str());
+        }
+    }
+}
+
+// Accept connections forever, handing them to the workers
+void DecodeDaemon::run()
+{
+    for (int i = 0; i < workers_; i++) {
+        threads_.push_back(thread{ [this]() { worker(); } });
+    }
+
+    while (true) {
+        {
+            unique_lock<mutex> lock{ mutex_ };
+            notFull_.wait(lock, [this]() { return queue_.size() < maxQueue_; });
+        }
+
+        int fd = accept(listenFd_, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            string err = strerror(errno);
+            stop();
+            throw runtime_error{ "accept failed: " + err + "." };
+        }
+
+        {
+            unique_lock<mutex> lock{ mutex_ };
+            queue_.push_back({ fd, Clock::now() });
+        }
+        notEmpty_.notify_one();
+    }
+}
+
+// Let the workers finish what's queued and wait for them to exit
+void DecodeDaemon::stop()
+{
+    {
+        unique_lock<mutex> lock{ mutex_ };
+        stopping_ = true;
+    }
+    notEmpty_.notify_all();
+
+    for (auto &t : threads_) {
+        t.join();
+    }
+    threads_.clear();
+}
+
+// Run jobs from the queue until stopped
+void DecodeDaemon::worker()
+{
+    while (true) {
+        int fd;
+        Clock::time_point queued;
+
+        {
+            unique_lock<mutex> lock{ mutex_ };
+            notEmpty_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            fd = queue_.front().first;
+            queued = queue_.front().second;
+            queue_.pop_front();
+        }
+        notFull_.notify_one();
+
+        std::chrono::duration<double> waited = Clock::now() - queued;
+        serve(fd, waited.count());
+        close(fd);
+    }
+}
+
+// Handle one connection
+void DecodeDaemon::serve(int fd, double queueSeconds)
+{
+    string pending;
+    string reply;
+
+    try {
+        string request = readLine(fd, pending);
+        reply = decode(fd, request, pending, queueSeconds);
+    } catch (const exception &e) {
+        // not just runtime_error: a job which can't get its memory
+        // mustn't take the daemon down with it
+        reply = string{ "ERROR " } + e.what() + "\n";
+    }
+
+    writeAll(fd, reply);
+}
+
+// Parse a request, run the decode and build the reply
+string DecodeDaemon::decode(int fd, const string &request, string &pending, double queueSeconds)
+{
+    stringstream in{ request };
+    string command;
+    in >> command;
+
+    if (command != "DECODE" && command != "SAMPLES") {
+        throw runtime_error{ "unknown command" };
+    }
+
+    DecodeOptions opts = opts_;
+    string arg;
+
+    // options up to the `--', which must be there so a mistyped option
+    // can't be taken for part of the path, or the path for an option
+    while (true) {
+        if (!(in >> arg)) {
+            throw runtime_error{ "missing --" };
+        }
+        if (arg == "--") {
+            break;
+        }
+        if (arg.size() < 2 || arg[1] != '=') {
+            throw runtime_error{ "unknown option " + arg };
+        }
+
+        int value = atoi(arg.c_str() + 2);
+        switch (arg[0]) {
+        case 'c': opts.clip = value; break;
+        case 'd': opts.dcwin = value; break;
+        case 'i': opts.poles = value; break;
+        case 'n': opts.negate = value; break;
+        case 'a': opts.adaptive = value; break;
+        case 'p': opts.recoverClock = value; break;
+        case 'B': opts.baud = value; break;
+        case 'q':
+            opts.quality = atof(arg.c_str() + 2);
+            opts.qualitySkip = arg.find(':') != string::npos;
+            if (opts.qualitySkip && arg.substr(arg.find(':')) != ":skip") {
+                opts.quality = -1;
+            }
+            break;
+        default:
+            throw runtime_error{ "unknown option " + arg };
+        }
+    }
+
+    // the rest of the line, after the space following `--', is the path
+    // or count
+    arg.clear();
+    std::getline(in, arg);
+    if (arg.size() && arg[0] == ' ') {
+        arg.erase(0, 1);
+    }
+
+    if (arg.empty()) {
+        throw runtime_error{ "missing " + string{ command == "DECODE" ? "path" : "count" } };
+    }
+
+    if (opts.dcwin <= 0) {
+        throw runtime_error{ "invalid DC window" };
+    }
+    if (opts.poles < 0 || opts.poles > 2) {
+        throw runtime_error{ "invalid DC filter poles" };
+    }
+    if (opts.baud != BaudFilter::AUTO && opts.baud != 300 && opts.baud != 600 && opts.baud != 1200) {
+        throw runtime_error{ "invalid baud rate" };
+    }
+    if (opts.quality < 0) {
+        throw runtime_error{ "invalid quality time" };
+    }
+
+    unique_ptr<SampleSource> source;
+    AudioReader *reader = nullptr;
+
+    if (command == "DECODE") {
+        try {
+            auto audio = AudioReader::open(arg);
+            reader = audio.get();
+            source = std::move(audio);
+        } catch (runtime_error re) {
+            throw runtime_error{ arg + ": " + re.what() };
+        }
+        if (reader->getSampleRate() != 44100) {
+            throw runtime_error{ arg + ": file must be 44kHz" };
+        }
+    } else {
+        uint64_t count = strtoull(arg.c_str(), nullptr, 10);
+        if (count > MAX_SAMPLES) {
+            throw runtime_error{ "too many samples" };
+        }
+
+        // read the little-endian samples straight in and put them in
+        // order in place
+        vector<int16_t> samples(count);
+        readExact(fd, reinterpret_cast<char *>(samples.data()), count * sizeof(int16_t), pending);
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(samples.data());
+        for (size_t i = 0; i < count; i++) {
+            samples[i] = int16_t(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+        }
+        source = unique_ptr<SampleSource>{ new MemorySource{ std::move(samples), 44100 } };
+    }
+
+    // counters are per thread, so each job can count its own
+    unique_ptr<PerfCounters> perf;
+    if (perfCounters_) {
+        perf = unique_ptr<PerfCounters>{ new PerfCounters{} };
+    }
+
+    Decoder decoder{ *source, opts };
+    decoder.run();
+
+    stringstream out;
+    out << "OK " << decoder.getChars().size() << "\n" << decoder.getChars();
+    out << decoder.getStats();
+    if (reader) {
+        out << "io-wait-seconds " << reader->getIoWaitSeconds() << endl;
+    }
+    out << "queue-seconds " << queueSeconds << endl;
+    if (perf) {
+        perf->report(out);
+    }
+
+    return out.str();
+}
@@ -0,0 +1,71 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "decoder.h"
+
+// Decodes jobs sent over a Unix domain socket with a fixed pool of 
+// worker threads. Each connection is one job; the client sends one
+// request line,
+//
+//   DECODE [option=value...] -- path
+//   SAMPLES [option=value...] -- count
+//
+// where the path is the rest of the line after the `--', and SAMPLES is
+// followed by `count' 16 bit little-endian mono samples 
+// at 44.1 kHz. The options are the cache key options c, d, i, n, a, p, B
+// (the baud rate, or 0 to work it out) and q (seconds[:skip], as -q), and
+// default to those the daemon was started with. The reply is either
+//
+//   OK length
+//
+// followed by `length' bytes of decoded output and then the statistics
+// for the job, one per line, or
+//
+//   ERROR message
+//
+// Connections are queued for the workers up to a fixed depth; when the
+// queue is full, the daemon stops accepting connections until a worker
+// is free. If accepting fails, run() throws once the workers have
+// finished the jobs already queued.
+//
+class DecodeDaemon {
+public:
+    DecodeDaemon(const std::string &path, int workers, const DecodeOptions &opts, bool perfCounters);
+    ~DecodeDaemon();
+
+    void run();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::string path_;
+    int workers_;
+    DecodeOptions opts_;
+    bool perfCounters_;
+    int listenFd_;
+
+    // accepted connections waiting for a worker
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::deque<std::pair<int, Clock::time_point>> queue_;
+    size_t maxQueue_;
+    bool stopping_;
+    std::vector<std::thread> threads_;
+
+    void stop();
+    void worker();
+    void serve(int fd, double queueSeconds);
+    std::string decode(int fd, const std::string &request, std::string &pending, double queueSeconds);
+};
+
+#endif
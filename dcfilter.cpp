@@ -1,6 +1,9 @@
 #include "dcfilter.h"
 
-#include "wave.h"
+#include "latency.h"
+#include "perfctr.h"
+#include "probes.h"
+#include "stage.h"
 
 #include <algorithm>
 #include <iostream>
@@ -10,14 +13,41 @@ using std::cout;
 using std::endl;
 using std::vector;
 
-DCFilter::DCFilter(WaveReader &wave, int window)
+DCFilter::DCFilter(SampleSource &wave, int window, Mode mode)
     : wave_(wave)
+    , meter_(nullptr)
+    , rawSamples_(0)
     , window_(window)
+    , mode_(mode)
+    , shift_(poleShift(window))
     , samples_(0)
     , sampleIn_(0)
     , sampleOut_(window / 2)
 {
-    sampleWindow_ = wave.readSamples(window);
+    dc_[0] = dc_[1] = 0;
+
+    if (mode_ == Average) {
+        sampleWindow_ = wave.readSamples(window);
+        rawSamples_ = sampleWindow_.size();
+    }
+}
+
+// The shift for a high-pass filter with about the same time constant as
+// averaging over `window' samples
+int DCFilter::poleShift(int window)
+{
+    int shift = 1;
+    while (shift < 16 && (2 << shift) <= window) {
+        shift++;
+    }
+    return shift;
+}
+
+// Report the arrival of each block of samples to `meter'
+void DCFilter::meter(LatencyMeter &meter)
+{
+    meter_ = &meter;
+    meter_->samplesArrived(rawSamples_);
 }
 
 // Read some samples. Try to remove DC by subtracting out a windowed
@@ -25,9 +55,24 @@ DCFilter::DCFilter(WaveReader &wave, int window)
 //
 vector<int16_t> DCFilter::readSamples(uint32_t nsamples)
 {
-    // is the entire stream too small to filter?
+    PerfScope scope{ PerfCounters::DC };
+    OSIWAVE_PROBE1(samples_entry, nsamples);
+    const uint32_t requested = nsamples;
+
+    if (mode_ != Average) {
+        vector<int16_t> out = readHighPass(nsamples);
+        OSIWAVE_PROBE2(samples_return, requested, out.size());
+        return out;
+    }
+
+    // is the entire stream too small to filter? then it's passed on as
+    // it is, and the stream ends once it's all been read
     if (samples_ == 0 && sampleWindow_.size() < window_) {
-        return sampleWindow_;
+        uint32_t n = std::min<size_t>(nsamples, sampleWindow_.size());
+        vector<int16_t> out{ sampleWindow_.begin(), sampleWindow_.begin() + n };
+        sampleWindow_.erase(sampleWindow_.begin(), sampleWindow_.begin() + n);
+        OSIWAVE_PROBE2(samples_return, requested, out.size());
+        return out;
     }
 
     vector<int16_t> out;
@@ -50,6 +95,7 @@ vector<int16_t> DCFilter::readSamples(uint32_t nsamples)
     }
 
     if (nsamples == 0) {
+        OSIWAVE_PROBE2(samples_return, requested, out.size());
         return out;
     }
 
@@ -60,6 +106,11 @@ vector<int16_t> DCFilter::readSamples(uint32_t nsamples)
 
     vector<int16_t> raw = wave_.readSamples(nsamples);
 
+    rawSamples_ += raw.size();
+    if (meter_ && raw.size()) {
+        meter_->samplesArrived(rawSamples_);
+    }
+
     if (raw.size() == 0) {
         // end of file on source
         int avg = sum / window_;
@@ -69,6 +120,7 @@ vector<int16_t> DCFilter::readSamples(uint32_t nsamples)
             sampleOut_ = (sampleOut_ + 1) % window_;
         }
 
+        OSIWAVE_PROBE2(samples_return, requested, out.size());
         return out;
     }
 
@@ -88,5 +140,33 @@ vector<int16_t> DCFilter::readSamples(uint32_t nsamples)
         sampleOut_ = (sampleOut_ + 1) % window_;
     }
 
+    OSIWAVE_PROBE2(samples_return, requested, out.size());
+    return out;
+}
+
+// Read some samples through the high-pass filter. The DC estimate starts
+// at the first sample, so there's no settling time at the start.
+//
+vector<int16_t> DCFilter::readHighPass(uint32_t nsamples)
+{
+    vector<int16_t> out = wave_.readSamples(nsamples);
+
+    if (out.size() && rawSamples_ == 0) {
+        dc_[0] = primePole(out[0]);
+    }
+
+    rawSamples_ += out.size();
+    if (meter_ && out.size()) {
+        meter_->samplesArrived(rawSamples_);
+    }
+
+    for (int16_t &samp : out) {
+        int32_t y = pole(samp, dc_[0], shift_);
+        if (mode_ == TwoPole) {
+            y = pole(y, dc_[1], shift_);
+        }
+        samp = clamp(y);
+    }
+
     return out;
 }
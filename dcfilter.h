@@ -4,21 +4,58 @@
 #include <cstdint>
 #include <vector>
 
-class WaveReader;
+class LatencyMeter;
+class SampleSource;
 
 class DCFilter {
 public:
-    DCFilter(WaveReader& wave, int window);
+    // How DC is removed: by subtracting the average of a window centred
+    // on each sample, or with a one or two pole high-pass filter, which
+    // has no delay and needs no window of samples to get started. The
+    // modes are numbered by poles.
+    //
+    enum Mode { Average = 0, OnePole = 1, TwoPole = 2 };
 
+    DCFilter(SampleSource& wave, int window, Mode mode = Average);
+
+    void meter(LatencyMeter &meter);
     std::vector<int16_t> readSamples(uint32_t nsamples);
 
+    uint64_t getSampleCount() const { return rawSamples_; }
+
+    // The high-pass filter keeps a fixed point estimate of the DC level
+    // with FRACTION_BITS bits below the point, and moves it 1/2^shift of
+    // the way to each sample, where 2^shift is the window rounded down to
+    // a power of two. Each pole takes its DC estimate out of its input.
+    //
+    static const int FRACTION_BITS = 12;
+
+    static int poleShift(int window);
+
+    static int32_t primePole(int32_t x) { return x * (1 << FRACTION_BITS); }
+
+    static int32_t pole(int32_t x, int32_t &dc, int shift)
+    {
+        dc += (x * (1 << FRACTION_BITS) - dc) >> shift;
+        return x - ((dc + (1 << (FRACTION_BITS - 1))) >> FRACTION_BITS);
+    }
+
+    static int16_t clamp(int32_t x) { return x < -32768 ? -32768 : (x > 32767 ? 32767 : x); }
+
 private:
-    WaveReader &wave_;
+    SampleSource &wave_;
+    LatencyMeter *meter_;
+    uint64_t rawSamples_;
     int window_;
+    Mode mode_;
+    int shift_;
+    int32_t dc_[2];
     std::vector<int16_t> sampleWindow_;
     uint32_t samples_;
     uint32_t sampleIn_;
     uint32_t sampleOut_;
+
+    std::vector<int16_t> readHighPass(uint32_t nsamples);
 };
 
 #endif
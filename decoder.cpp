@@ -0,0 +1,167 @@
+#include "decoder.h"
+
+#include "bandtrk.h"
+#include "baud.h"
+#include "bitstrm.h"
+#include "dcfilter.h"
+#include "denoise.h"
+#include "freqspan.h"
+#include "fused.h"
+#include "quality.h"
+#include "stage.h"
+#include "xcross.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::endl;
+using std::string;
+using std::stringstream;
+using std::unique_ptr;
+using std::vector;
+
+Decoder::Decoder(SampleSource &source, const DecodeOptions &opts)
+    : source_(&source)
+    , crossings_(nullptr)
+    , opts_(opts)
+    , seconds_(0)
+    , started_(false)
+{
+}
+
+Decoder::Decoder(CrossingSource &crossings, const DecodeOptions &opts)
+    : source_(nullptr)
+    , crossings_(&crossings)
+    , opts_(opts)
+    , seconds_(0)
+    , started_(false)
+{
+}
+
+Decoder::~Decoder()
+{
+}
+
+// Decode the whole file
+void Decoder::run()
+{
+    while (step()) {
+    }
+}
+
+// Decode the next block of output. Returns false at end of file.
+bool Decoder::step()
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (!started_) {
+        start();
+        started_ = true;
+    }
+
+    vector<char> chunk = frames_->getChars(opts_.blocks['o']);
+
+    chars_.append(chunk.begin(), chunk.end());
+    for (auto pos : frames_->getPositions()) {
+        if (quality_) {
+            pos.start = quality_->fileTime(pos.start);
+            pos.stop = quality_->fileTime(pos.stop);
+        }
+        positions_.push_back(pos);
+    }
+    auto &confidences = frames_->getConfidences();
+    confidences_.insert(confidences_.end(), confidences.begin(), confidences.end());
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    seconds_ += elapsed.count();
+
+    return chunk.size() != 0;
+}
+
+// Build the chain
+void Decoder::start()
+{
+    // NB as in main, the filters may prefill data in their constructors
+    if (source_ && opts_.clip) {
+        source_->skip(opts_.clip);
+    }
+
+    SampleSource *source = source_;
+    if (opts_.quality > 0) {
+        quality_ = unique_ptr<QualityMonitor>{ new QualityMonitor{ opts_.quality, opts_.qualitySkip ? QualityMonitor::Skip : QualityMonitor::Abort } };
+        if (source) {
+            source = &quality_->gate(*source);
+        }
+    }
+
+    SpanSource *spans;
+    if (source && opts_.fused) {
+        fused_ = unique_ptr<FusedFrontEnd>{ new FusedFrontEnd{ *source, opts_.dcwin, opts_.dcMode(), opts_.negate, opts_.blocks['z'] } };
+        if (opts_.adaptive) { fused_->adapt(); }
+        spans = fused_.get();
+    } else {
+        if (source) {
+            dcFilter_ = unique_ptr<DCFilter>{ new DCFilter{ *source, opts_.dcwin, opts_.dcMode() } };
+            zeroCross_ = unique_ptr<ZeroCrossFilter>{ new ZeroCrossFilter{ *dcFilter_, source->getSampleRate(), opts_.negate, opts_.blocks['z'] } };
+            crossings_ = zeroCross_.get();
+        }
+
+        freqSpan_ = unique_ptr<FreqSpanFilter>{ new FreqSpanFilter{ *crossings_, opts_.blocks['f'] } };
+        if (opts_.adaptive) { freqSpan_->adapt(); }
+        spans = freqSpan_.get();
+    }
+
+    if (quality_) {
+        spans = &quality_->tap(*spans);
+    }
+
+    if (opts_.baud != BandTracker::BAUD_RATE) {
+        baud_ = unique_ptr<BaudFilter>{ new BaudFilter{ *spans, opts_.baud, opts_.blocks['n'] } };
+        spans = baud_.get();
+    }
+
+    denoise_ = unique_ptr<DeNoiseFilter>{ new DeNoiseFilter{ *spans, opts_.blocks['n'] } };
+
+    bitstream_ = unique_ptr<BitstreamFilter>{ new BitstreamFilter{ *denoise_, opts_.blocks['b'] } };
+    if (opts_.recoverClock) { bitstream_->recoverClock(); }
+
+    frames_ = unique_ptr<FrameFilter>{ new FrameFilter{ *bitstream_, opts_.blocks['c'] } };
+    if (quality_) { quality_->watch(*frames_); }
+}
+
+// Return the decode statistics, in the same form as -s. How long was
+// spent waiting for the source is up to the caller, who knows what the 
+// source is.
+//
+string Decoder::getStats() const
+{
+    stringstream ss;
+
+    if (dcFilter_) {
+        ss << "samples " << dcFilter_->getSampleCount() << endl;
+    }
+    if (fused_) {
+        ss << "samples " << fused_->getSampleCount() << endl;
+    }
+    if (baud_) {
+        ss << "baud";
+        for (int baud : baud_->getRecordBauds()) {
+            ss << " " << baud;
+        }
+        ss << endl;
+    }
+    if (bitstream_ && opts_.recoverClock) {
+        ss << "pll-locked " << double(bitstream_->getLockedBits()) / std::max<uint64_t>(bitstream_->getBitCount(), 1) << endl;
+    }
+    if (quality_) {
+        ss << quality_->getStats();
+    }
+    ss
+        << "chars " << chars_.size() << endl
+        << "decode-seconds " << seconds_ << endl;
+
+    return ss.str();
+}
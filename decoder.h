@@ -0,0 +1,95 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dcfilter.h"
+#include "frameflt.h"
+
+class BaudFilter;
+class CrossingSource;
+class SampleSource;
+class ZeroCrossFilter;
+class FreqSpanFilter;
+class FusedFrontEnd;
+class DeNoiseFilter;
+class BitstreamFilter;
+class QualityMonitor;
+
+// The version of the decode chain's output. Cached results are kept
+// under it, so it must be bumped by any change to the text decoded from
+// the same samples with the same options.
+//
+const int DECODE_VERSION = 2;
+
+// The options which affect how a wave file is decoded
+//
+struct DecodeOptions {
+    int clip = 0;
+    int dcwin = 96;
+    int poles = 0;      // high-pass DC filter poles, or 0 to average
+    bool negate = false;
+    bool adaptive = false;
+    bool recoverClock = false;
+    bool fused = false;     // DC, crossings and spans in one pass, as -f
+    int baud = 300;         // or 0 to work out for each record
+    double quality = 0;     // seconds of poor signal to give up after, or 0
+    bool qualitySkip = false;   // skip ahead to the next tone instead
+
+    // block sizes by stage letter, as for -b
+    std::map<char, int> blocks{ { 'z', 4096 }, { 'f', 1024 }, { 'n', 1024 }, { 'b', 1024 }, { 'c', 1024 }, { 'o', 4096 } };
+
+    DCFilter::Mode dcMode() const { return static_cast<DCFilter::Mode>(poles); }
+};
+
+// Runs the usual decode chain from samples to characters, keeping 
+// everything decoded. This is for decoding many captures at once; the 
+// main program builds its own chain so stages can be dumped, traced 
+// and so on.
+//
+// A decoder may instead start from crossings found elsewhere, such as 
+// a LaneFrontEnd, in which case the clip and DC options are up to 
+// whoever found them. step() decodes one block of output at a time so
+// several decoders can share a source which isn't thread safe.
+//
+class Decoder {
+public:
+    Decoder(SampleSource &source, const DecodeOptions &opts);
+    Decoder(CrossingSource &crossings, const DecodeOptions &opts);
+    ~Decoder();
+
+    void run();
+    bool step();
+
+    const std::string &getChars() const { return chars_; }
+    const std::vector<FrameFilter::Position> &getPositions() const { return positions_; }
+    const std::vector<double> &getConfidences() const { return confidences_; }
+    std::string getStats() const;
+
+private:
+    SampleSource *source_;
+    CrossingSource *crossings_;
+    DecodeOptions opts_;
+    std::string chars_;
+    std::vector<FrameFilter::Position> positions_;
+    std::vector<double> confidences_;
+    double seconds_;
+    bool started_;
+
+    std::unique_ptr<DCFilter> dcFilter_;
+    std::unique_ptr<ZeroCrossFilter> zeroCross_;
+    std::unique_ptr<FreqSpanFilter> freqSpan_;
+    std::unique_ptr<FusedFrontEnd> fused_;
+    std::unique_ptr<BaudFilter> baud_;
+    std::unique_ptr<DeNoiseFilter> denoise_;
+    std::unique_ptr<BitstreamFilter> bitstream_;
+    std::unique_ptr<FrameFilter> frames_;
+    std::unique_ptr<QualityMonitor> quality_;
+
+    void start();
+};
+
+#endif
@@ -1,26 +1,28 @@
 #include "denoise.h"
 
-#include <vector>
+#include "perfctr.h"
+#include "probes.h"
 
-namespace {
-    const int BAUD_RATE = 300;
-    const double MS_PER_CLOCK = 1000.0 / BAUD_RATE;
-}
+#include <vector>
 
 using std::vector;
 
-DeNoiseFilter::DeNoiseFilter(FreqSpanFilter &fs)
-    : fs_(fs)
-    , spanIdx_(0)
-    , eof_(false)
+DeNoiseFilter::DeNoiseFilter(SpanSource &fs, int window)
+    : spans_(fs, window)
+    , flush_(false)
 {
-    spans_ = fs.getSpans(WINDOW);
-
-    prevSpan_ = getNextSpan();
-    if (prevSpan_.value == FreqSpanFilter::Noise) {
-        prevSpan_ = getNextSpan();
+    prevSpan_ = spans_.next();
+    if (prevSpan_.value == Noise) {
+        prevSpan_ = spans_.next();
     }
-    currSpan_ = getNextSpan();
+    currSpan_ = spans_.next();
+}
+
+// Return as soon as the buffered spans are used up, rather than
+// waiting for a full block
+void DeNoiseFilter::flush()
+{
+    flush_ = true;
 }
 
 // Read a stream of frequency spans, some of which are noise. Attempt to
@@ -30,45 +32,66 @@ DeNoiseFilter::DeNoiseFilter(FreqSpanFilter &fs)
 //
 vector<DeNoiseFilter::Span> DeNoiseFilter::getSpans(int nspans)
 { 
+    PerfScope scope{ PerfCounters::DeNoise };
+    OSIWAVE_PROBE1(spans_entry, nspans);
+
     vector<Span> spans;
 
-    while (spans.size() < nspans && !eof_) {
-        if (currSpan_.value != FreqSpanFilter::Noise) {
-            double clocks = (prevSpan_.length * 1000.0) / MS_PER_CLOCK;
+    while (spans.size() < nspans && !spans_.eof()) {
+        if (flush_ && spans.size() && spans_.drained()) {
+            break;
+        }
+
+        if (currSpan_.value != Noise) {
+            double clocks = prevSpan_.length / prevSpan_.clock;
             prevSpan_.clocks = int(clocks + 0.5);    
+            prevSpan_.evidence.offClock = dFromClock(prevSpan_);
             spans.push_back(prevSpan_);
             prevSpan_ = currSpan_;
-            currSpan_ = getNextSpan();
+            currSpan_ = spans_.next();
             continue;           
         }
 
-        Span nextSpan = getNextSpan();
-        if (eof_) {
+        Span nextSpan = spans_.next();
+        if (spans_.eof()) {
             break;
         }
 
-        if (dFromClock(prevSpan_.length) > dFromClock(nextSpan.length)) {
+        // a run of noise spans is treated as one, counting how many it was
+        // in the merged span's evidence
+        if (nextSpan.value == Noise) {
+            currSpan_.length += nextSpan.length;
+            currSpan_.evidence.noise++;
+            continue;
+        }
+
+        if (dFromClock(prevSpan_) > dFromClock(nextSpan)) {
             prevSpan_.length += currSpan_.length;
+            prevSpan_.evidence.noise += currSpan_.evidence.noise + 1;
         } else {
+            nextSpan.start = currSpan_.start;
             nextSpan.length += currSpan_.length;
+            nextSpan.evidence.noise += currSpan_.evidence.noise + 1;
         }
         
-        double clocks = (prevSpan_.length * 1000.0) / MS_PER_CLOCK;
+        double clocks = prevSpan_.length / prevSpan_.clock;
         prevSpan_.clocks = int(clocks + 0.5);    
+        prevSpan_.evidence.offClock = dFromClock(prevSpan_);
         spans.push_back(prevSpan_);
         
-        prevSpan_ = currSpan_;
-        currSpan_ = nextSpan;
+        prevSpan_ = nextSpan;
+        currSpan_ = spans_.next();
     }
 
+    OSIWAVE_PROBE2(spans_return, nspans, spans.size());
     return spans;
 }
 
 // how far from an integral number of clocks is the given
-// period in milliseconds
-double DeNoiseFilter::dFromClock(double len)
+// span, using the bit clock at the time of the span
+double DeNoiseFilter::dFromClock(const Span &span)
 {
-    double clk = (len * 1000) / MS_PER_CLOCK;
+    double clk = span.length / span.clock;
     clk -= int(clk);
     if (clk > 0.5) {
         clk = 1.0 - clk;
@@ -76,25 +99,3 @@ double DeNoiseFilter::dFromClock(double len)
 
     return clk;
 }
-
-// Get the next buffered span
-DeNoiseFilter::Span DeNoiseFilter::getNextSpan()
-{
-    if (eof_) {
-        return Span{};
-    }
-    
-    if (spanIdx_ < spans_.size()) {
-        return spans_[spanIdx_++];
-    }
-
-    spans_ = fs_.getSpans(WINDOW);
-
-    if (spans_.size() == 0) {
-        eof_ = true;
-        return Span{};
-    }
-
-    spanIdx_ = 0;
-    return spans_[spanIdx_++];
-}      
@@ -3,30 +3,25 @@
 
 #include <vector>
 
-#include "freqspan.h"
+#include "blockrd.h"
+#include "stage.h"
 
-class DeNoiseFilter {
+class DeNoiseFilter : public SpanSource {
 public:
-    using Span = FreqSpanFilter::Span;
+    DeNoiseFilter(SpanSource &fs, int window = 1024);
 
-    DeNoiseFilter(FreqSpanFilter &fs);
+    void flush();
   
-    std::vector<Span> getSpans(int nspans);
+    std::vector<Span> getSpans(int nspans) override;
 
 private:
-    const int WINDOW = 1024;
-    
-    FreqSpanFilter fs_;
-
-    std::vector<Span> spans_;
-    int spanIdx_;
-    bool eof_;
+    BlockReader<SpanSource> spans_;
+    bool flush_;
 
     Span prevSpan_;
     Span currSpan_;
 
-    double dFromClock(double len);
-    Span getNextSpan();
+    double dFromClock(const Span &span);
 };
 
 #endif
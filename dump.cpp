@@ -0,0 +1,318 @@
+#include "dump.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::ios;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+using Span = SpanSource::Span;
+
+// The file format is a header:
+//   4 bytes  magic "OSWD"
+//   1 byte   format version
+//   1 byte   stage letter
+// followed by blocks, one per block of data the stage returned:
+//   4 bytes  record count
+//   records
+// All words are little endian. Crossings are 8 byte doubles; spans are
+// a 1 byte value, 4 byte clock count, and 8 byte doubles for the start,
+// length and bit clock; bits are packed 8 to a byte, LSB first.
+//
+namespace {
+    const char MAGIC[] = "OSWD";
+    const int VERSION = 3;
+
+    const int SPAN_SIZE = 29;
+
+    uint64_t doubleBits(double d)
+    {
+        uint64_t w;
+        memcpy(&w, &d, sizeof(w));
+        return w;
+    }
+
+    double bitsDouble(uint64_t w)
+    {
+        double d;
+        memcpy(&d, &w, sizeof(d));
+        return d;
+    }
+
+    bool validStage(char stage)
+    {
+        return stage == 'z' || stage == 'f' || stage == 'n' || stage == 'b';
+    }
+}
+
+DumpWriter::DumpWriter(const string &fname, char stage)
+    : stage_(stage)
+{
+    if (!validStage(stage)) {
+        throw runtime_error{ string{ "invalid dump stage `" } + stage + "'." };
+    }
+
+    out_.open(fname, ios::binary|ios::trunc);
+    if (!out_) {
+        throw runtime_error{ "failed to open dump file " + fname + "." };
+    }
+
+    buf_.insert(buf_.end(), MAGIC, MAGIC + 4);
+    buf_.push_back(VERSION);
+    buf_.push_back(stage);
+    flush();
+}
+
+// Write one block of crossing timestamps
+void DumpWriter::writeCrossings(const vector<double> &crossings)
+{
+    putWord(crossings.size(), 4);
+    for (double t : crossings) {
+        putWord(doubleBits(t), 8);
+    }
+    flush();
+}
+
+// Write one block of spans
+void DumpWriter::writeSpans(const vector<Span> &spans)
+{
+    putWord(spans.size(), 4);
+    for (const Span &span : spans) {
+        putWord(span.value, 1);
+        putWord(static_cast<uint32_t>(span.clocks), 4);
+        putWord(doubleBits(span.start), 8);
+        putWord(doubleBits(span.length), 8);
+        putWord(doubleBits(span.clock), 8);
+    }
+    flush();
+}
+
+// Write one block of bits
+void DumpWriter::writeBits(const vector<bool> &bits)
+{
+    putWord(bits.size(), 4);
+
+    uint8_t byte = 0;
+    for (size_t i = 0; i < bits.size(); i++) {
+        if (bits[i]) {
+            byte |= 1 << (i % 8);
+        }
+        if (i % 8 == 7) {
+            buf_.push_back(byte);
+            byte = 0;
+        }
+    }
+
+    if (bits.size() % 8) {
+        buf_.push_back(byte);
+    }
+    flush();
+}
+
+// Append a little-endian word to the output buffer
+void DumpWriter::putWord(uint64_t w, int nbytes)
+{
+    for (int i = 0; i < nbytes; i++) {
+        buf_.push_back(static_cast<char>(w & 0xff));
+        w >>= 8;
+    }
+}
+
+// Write out the buffered block
+void DumpWriter::flush()
+{
+    out_.write(buf_.data(), buf_.size());
+    if (!out_) {
+        throw runtime_error{ "failed writing dump file." };
+    }
+    buf_.clear();
+}
+
+CrossingTap::CrossingTap(CrossingSource &src, DumpWriter &dump)
+    : src_(src)
+    , dump_(dump)
+{
+}
+
+vector<double> CrossingTap::getTimestamps(int ncross)
+{
+    vector<double> crossings = src_.getTimestamps(ncross);
+    if (crossings.size()) {
+        dump_.writeCrossings(crossings);
+    }
+    return crossings;
+}
+
+SpanTap::SpanTap(SpanSource &src, DumpWriter &dump)
+    : src_(src)
+    , dump_(dump)
+{
+}
+
+vector<Span> SpanTap::getSpans(int nspans)
+{
+    vector<Span> spans = src_.getSpans(nspans);
+    if (spans.size()) {
+        dump_.writeSpans(spans);
+    }
+    return spans;
+}
+
+BitTap::BitTap(BitSource &src, DumpWriter &dump)
+    : src_(src)
+    , dump_(dump)
+{
+}
+
+vector<bool> BitTap::getBits(int nbits)
+{
+    vector<bool> bits = src_.getBits(nbits);
+    if (bits.size()) {
+        dump_.writeBits(bits);
+    }
+    return bits;
+}
+
+// Open a dump and verify the header
+//
+DumpReader::DumpReader(const string &fname)
+    : stage_(0)
+    , bufIdx_(0)
+    , recIdx_(0)
+    , recCount_(0)
+{
+    const string badFile = "file is not an osiwave dump.";
+
+    in_.open(fname, ios::binary);
+    if (!in_) {
+        throw runtime_error{ "failed to open file." };
+    }
+
+    char header[6];
+    if (!in_.read(header, sizeof(header)) || string(header, 4) != MAGIC) {
+        throw runtime_error{ badFile };
+    }
+
+    if (header[4] != VERSION) {
+        throw runtime_error{ "unsupported dump version." };
+    }
+
+    stage_ = header[5];
+    if (!validStage(stage_)) {
+        throw runtime_error{ badFile };
+    }
+}
+
+// Read crossings from a `z' dump
+vector<double> DumpReader::getTimestamps(int ncross)
+{
+    checkStage('z');
+
+    vector<double> out;
+    out.reserve(ncross);
+
+    while (out.size() < ncross && (recIdx_ < recCount_ || nextBlock())) {
+        out.push_back(bitsDouble(getWord(8)));
+        recIdx_++;
+    }
+
+    return out;
+}
+
+// Read spans from an `f' or `n' dump
+vector<Span> DumpReader::getSpans(int nspans)
+{
+    if (stage_ != 'n') {
+        checkStage('f');
+    }
+
+    vector<Span> out;
+    out.reserve(nspans);
+
+    while (out.size() < nspans && (recIdx_ < recCount_ || nextBlock())) {
+        Span span{};
+        span.value = static_cast<Value>(getWord(1));
+        span.clocks = static_cast<int32_t>(getWord(4));
+        span.start = bitsDouble(getWord(8));
+        span.length = bitsDouble(getWord(8));
+        span.clock = bitsDouble(getWord(8));
+        out.push_back(span);
+        recIdx_++;
+    }
+
+    return out;
+}
+
+// Read bits from a `b' dump
+vector<bool> DumpReader::getBits(int nbits)
+{
+    checkStage('b');
+
+    vector<bool> out;
+    out.reserve(nbits);
+
+    while (out.size() < nbits && (recIdx_ < recCount_ || nextBlock())) {
+        out.push_back((buf_[recIdx_ / 8] >> (recIdx_ % 8)) & 1);
+        recIdx_++;
+    }
+
+    return out;
+}
+
+// Load the next block into the buffer. Returns false at end of file.
+//
+bool DumpReader::nextBlock()
+{
+    char count[4];
+
+    do {
+        if (!in_.read(count, 4)) {
+            return false;
+        }
+
+        recCount_ = 0;
+        for (int i = 3; i >= 0; i--) {
+            recCount_ = (recCount_ << 8) | static_cast<uint8_t>(count[i]);
+        }
+    } while (recCount_ == 0);
+
+    size_t nbytes = 0;
+    switch (stage_) {
+    case 'z': nbytes = recCount_ * sizeof(double); break;
+    case 'f':
+    case 'n': nbytes = recCount_ * SPAN_SIZE; break;
+    case 'b': nbytes = (recCount_ + 7) / 8; break;
+    }
+
+    buf_.resize(nbytes);
+    if (!in_.read(buf_.data(), nbytes)) {
+        throw runtime_error{ "premature end of file on dump." };
+    }
+
+    bufIdx_ = 0;
+    recIdx_ = 0;
+    return true;
+}
+
+// Read a little-endian word from the buffered block
+uint64_t DumpReader::getWord(int nbytes)
+{
+    uint64_t w = 0;
+    for (int i = nbytes-1; i >= 0; i--) {
+        w = (w << 8) | static_cast<uint8_t>(buf_[bufIdx_ + i]);
+    }
+    bufIdx_ += nbytes;
+    return w;
+}
+
+// Make sure the chain is asking for the kind of data in the dump
+void DumpReader::checkStage(char stage) const
+{
+    if (stage_ != stage) {
+        throw runtime_error{ string{ "dump holds stage `" } + stage_ + "' data, not `" + stage + "'." };
+    }
+}
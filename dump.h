@@ -0,0 +1,101 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "stage.h"
+
+// Dumps of intermediate stage output. A dump file holds everything one
+// stage produced during a decode, so the back end of the chain can be
+// rerun from that point without reading the wave file again.
+//
+// Stages are named with the same letters as tracing:
+//   z - zero crossing timestamps
+//   f - frequency spans, including noise
+//   n - spans after noise removal
+//   b - bits
+//
+class DumpWriter {
+public:
+    DumpWriter(const std::string &fname, char stage);
+
+    char getStage() const { return stage_; }
+
+    void writeCrossings(const std::vector<double> &crossings);
+    void writeSpans(const std::vector<SpanSource::Span> &spans);
+    void writeBits(const std::vector<bool> &bits);
+
+private:
+    char stage_;
+    std::ofstream out_;
+    std::vector<char> buf_;
+
+    void putWord(uint64_t w, int nbytes);
+    void flush();
+};
+
+// Taps which pass data through unchanged while writing it to a dump.
+//
+class CrossingTap : public CrossingSource {
+public:
+    CrossingTap(CrossingSource &src, DumpWriter &dump);
+    std::vector<double> getTimestamps(int ncross) override;
+
+private:
+    CrossingSource &src_;
+    DumpWriter &dump_;
+};
+
+class SpanTap : public SpanSource {
+public:
+    SpanTap(SpanSource &src, DumpWriter &dump);
+    std::vector<Span> getSpans(int nspans) override;
+
+private:
+    SpanSource &src_;
+    DumpWriter &dump_;
+};
+
+class BitTap : public BitSource {
+public:
+    BitTap(BitSource &src, DumpWriter &dump);
+    std::vector<bool> getBits(int nbits) override;
+    std::vector<double> getBitTimes() const override { return src_.getBitTimes(); }
+    std::vector<SpanSource::Evidence> getBitEvidence() const override { return src_.getBitEvidence(); }
+
+private:
+    BitSource &src_;
+    DumpWriter &dump_;
+};
+
+// Reads back a dump. Only the source matching the dump's stage may be
+// used; the reader can then be plugged into the chain in place of that
+// stage.
+//
+class DumpReader : public CrossingSource, public SpanSource, public BitSource {
+public:
+    DumpReader(const std::string &fname);
+
+    char getStage() const { return stage_; }
+
+    std::vector<double> getTimestamps(int ncross) override;
+    std::vector<Span> getSpans(int nspans) override;
+    std::vector<bool> getBits(int nbits) override;
+
+private:
+    char stage_;
+    std::ifstream in_;
+    std::vector<char> buf_;
+    size_t bufIdx_;
+    uint32_t recIdx_;
+    uint32_t recCount_;
+
+    bool nextBlock();
+    uint64_t getWord(int nbytes);
+    void checkStage(char stage) const;
+};
+
+#endif
@@ -0,0 +1,881 @@
+#include "flac.h"
+
+#include "hash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::ifstream;
+using std::ios;
+using std::runtime_error;
+using std::string;
+using std::stringstream;
+using std::thread;
+using std::vector;
+
+using Clock = std::chrono::steady_clock;
+using Seconds = std::chrono::duration<double>;
+
+namespace {
+    const string BAD_FILE = "file is not a FLAC file.";
+    const string BAD_FRAME = "corrupt FLAC frame.";
+
+    // How many frames are decoded at once
+    const size_t BATCH_FRAMES = 32;
+
+    // The most frames in a row which will be replaced by silence if they
+    // are damaged
+    const uint64_t MAX_GAP_FRAMES = 16;
+
+    // How much of the file is read at once
+    const size_t READ_CHUNK = 1 << 20;
+
+    // The longest frame header, with the longest frame number and the
+    // optional block size and sample rate
+    const size_t MAX_HEADER = 16;
+
+    // FLAC's CRC-8 (x^8 + x^2 + x + 1) and CRC-16 (x^16 + x^15 + x^2 + 1)
+    struct CrcTables {
+        uint8_t crc8[256];
+        uint16_t crc16[256];
+
+        CrcTables()
+        {
+            for (int i = 0; i < 256; i++) {
+                uint8_t c8 = i;
+                uint16_t c16 = i << 8;
+                for (int b = 0; b < 8; b++) {
+                    c8 = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+                    c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+                }
+                crc8[i] = c8;
+                crc16[i] = c16;
+            }
+        }
+    };
+
+    const CrcTables CRC;
+
+    // Reads the bits of a frame, most significant first
+    class BitReader {
+    public:
+        BitReader(const uint8_t *p, size_t len)
+            : p_(p)
+            , end_(p + len)
+            , cache_(0)
+            , bits_(0)
+        {
+        }
+
+        uint32_t read(int n)
+        {
+            if (n == 0) {
+                return 0;
+            }
+            if (bits_ < n) {
+                refill();
+            }
+            uint32_t v = cache_ >> (64 - n);
+            cache_ <<= n;
+            bits_ -= n;
+            return v;
+        }
+
+        int32_t readSigned(int n)
+        {
+            if (n == 0) {
+                return 0;
+            }
+            uint32_t v = read(n);
+            return int32_t(v << (32 - n)) >> (32 - n);
+        }
+
+        // count the zero bits before the next one bit
+        uint32_t readUnary()
+        {
+            uint32_t count = 0;
+            while (true) {
+                if (bits_ == 0 || cache_ == 0) {
+                    count += bits_;
+                    cache_ = 0;
+                    bits_ = 0;
+                    padding_ = 0;
+                    if (p_ == end_) {
+                        throw runtime_error{ BAD_FRAME };
+                    }
+                    refill();
+                    continue;
+                }
+
+                int zeroes = __builtin_clzll(cache_);
+                count += zeroes;
+                cache_ = zeroes == 63 ? 0 : cache_ << (zeroes + 1);
+                bits_ -= zeroes + 1;
+                return count;
+            }
+        }
+
+        int32_t readRice(int k)
+        {
+            uint32_t u = (readUnary() << k) | read(k);
+            return int32_t(u >> 1) ^ -int32_t(u & 1);
+        }
+
+        // Throws if the frame ran out before everything was read, that is,
+        // if some of the padding past the end has been used
+        void check() const
+        {
+            if (padding_ * 8 > bits_) {
+                throw runtime_error{ BAD_FRAME };
+            }
+        }
+
+    private:
+        const uint8_t *p_;
+        const uint8_t *end_;
+        uint64_t cache_;
+        int bits_;
+        int padding_ = 0;
+
+        void refill()
+        {
+            while (bits_ <= 56) {
+                uint64_t byte = 0;
+                if (p_ < end_) {
+                    byte = *p_++;
+                } else {
+                    padding_++;
+                }
+                cache_ |= byte << (56 - bits_);
+                bits_ += 8;
+            }
+        }
+    };
+
+    // Decode a residual into `res', after the `order' warm-up samples
+    void readResidual(BitReader &br, uint32_t blockSize, int order, int32_t *res)
+    {
+        int method = br.read(2);
+        if (method > 1) {
+            throw runtime_error{ BAD_FRAME };
+        }
+
+        int paramBits = method == 0 ? 4 : 5;
+        uint32_t escape = method == 0 ? 15 : 31;
+        int partitionOrder = br.read(4);
+        uint32_t partitions = 1u << partitionOrder;
+        uint32_t partSize = blockSize >> partitionOrder;
+
+        if (partSize << partitionOrder != blockSize || partSize < uint32_t(order)) {
+            throw runtime_error{ BAD_FRAME };
+        }
+
+        uint32_t i = order;
+        for (uint32_t part = 0; part < partitions; part++) {
+            uint32_t end = (part + 1) * partSize;
+            uint32_t k = br.read(paramBits);
+
+            if (k == escape) {
+                int bits = br.read(5);
+                for (; i < end; i++) {
+                    res[i] = br.readSigned(bits);
+                }
+            } else {
+                for (; i < end; i++) {
+                    res[i] = br.readRice(k);
+                }
+            }
+        }
+    }
+
+    // Decode one subframe of `bps' bit samples into `out'
+    void readSubframe(BitReader &br, uint32_t blockSize, int bps, int32_t *out)
+    {
+        if (br.read(1)) {
+            throw runtime_error{ BAD_FRAME };
+        }
+
+        int type = br.read(6);
+        int wasted = 0;
+        if (br.read(1)) {
+            wasted = br.readUnary() + 1;
+            bps -= wasted;
+            if (bps <= 0) {
+                throw runtime_error{ BAD_FRAME };
+            }
+        }
+
+        if (type == 0) {
+            // constant
+            int32_t v = br.readSigned(bps);
+            std::fill(out, out + blockSize, v);
+        } else if (type == 1) {
+            // verbatim
+            for (uint32_t i = 0; i < blockSize; i++) {
+                out[i] = br.readSigned(bps);
+            }
+        } else if (type >= 8 && type <= 12) {
+            // fixed predictor
+            int order = type - 8;
+            if (uint32_t(order) > blockSize) {
+                throw runtime_error{ BAD_FRAME };
+            }
+            for (int i = 0; i < order; i++) {
+                out[i] = br.readSigned(bps);
+            }
+            readResidual(br, blockSize, order, out);
+
+            switch (order) {
+            case 1:
+                for (uint32_t i = 1; i < blockSize; i++) {
+                    out[i] += out[i - 1];
+                }
+                break;
+            case 2:
+                for (uint32_t i = 2; i < blockSize; i++) {
+                    out[i] += 2 * out[i - 1] - out[i - 2];
+                }
+                break;
+            case 3:
+                for (uint32_t i = 3; i < blockSize; i++) {
+                    out[i] += 3 * out[i - 1] - 3 * out[i - 2] + out[i - 3];
+                }
+                break;
+            case 4:
+                for (uint32_t i = 4; i < blockSize; i++) {
+                    out[i] += 4 * out[i - 1] - 6 * out[i - 2] + 4 * out[i - 3] - out[i - 4];
+                }
+                break;
+            }
+        } else if (type >= 32) {
+            // linear prediction
+            int order = (type & 31) + 1;
+            if (uint32_t(order) > blockSize) {
+                throw runtime_error{ BAD_FRAME };
+            }
+            for (int i = 0; i < order; i++) {
+                out[i] = br.readSigned(bps);
+            }
+
+            int precision = br.read(4) + 1;
+            int shift = br.readSigned(5);
+            if (precision == 16 || shift < 0) {
+                throw runtime_error{ BAD_FRAME };
+            }
+
+            int32_t coefs[32];
+            for (int i = 0; i < order; i++) {
+                coefs[i] = br.readSigned(precision);
+            }
+
+            readResidual(br, blockSize, order, out);
+
+            for (uint32_t i = order; i < blockSize; i++) {
+                int64_t sum = 0;
+                for (int j = 0; j < order; j++) {
+                    sum += int64_t(coefs[j]) * out[i - j - 1];
+                }
+                out[i] += int32_t(sum >> shift);
+            }
+        } else {
+            throw runtime_error{ BAD_FRAME };
+        }
+
+        if (wasted) {
+            for (uint32_t i = 0; i < blockSize; i++) {
+                out[i] <<= wasted;
+            }
+        }
+    }
+}
+
+// Open the file and read the metadata
+//
+FlacReader::FlacReader(const string &fname)
+    : fname_(fname)
+    , sampleRate_(0)
+    , nchannels_(0)
+    , bps_(0)
+    , readChan_(0)
+    , totalSamples_(0)
+    , minBlock_(0)
+    , maxBlock_(0)
+    , firstFrame_(0)
+    , maxFrame_(0)
+    , threads_(std::max(1u, thread::hardware_concurrency()))
+    , fileEof_(false)
+    , batchEnd_(0)
+    , started_(false)
+    , pos_(0)
+    , ioWaitSeconds_(0)
+{
+    in_.open(fname, ios::binary);
+    if (!in_) {
+        throw runtime_error{ "failed to open file." };
+    }
+
+    current_.first = 0;
+    current_.eof = false;
+
+    readMetadata();
+}
+
+// Wait for any batch still being decoded, since it uses this object
+FlacReader::~FlacReader()
+{
+    if (next_.valid()) {
+        next_.wait();
+    }
+}
+
+// Read the metadata blocks up to the first frame. We need the stream
+// info, and the seek table if there is one.
+//
+void FlacReader::readMetadata()
+{
+    char magic[4];
+    if (!in_.read(magic, 4) || string(magic, 4) != "fLaC") {
+        throw runtime_error{ BAD_FILE };
+    }
+
+    uint64_t pos = 4;
+    bool haveInfo = false;
+    bool last = false;
+
+    while (!last) {
+        uint8_t header[4];
+        if (!in_.read(reinterpret_cast<char *>(header), 4)) {
+            throw runtime_error{ BAD_FILE };
+        }
+
+        last = header[0] & 0x80;
+        int type = header[0] & 0x7f;
+        uint32_t len = (header[1] << 16) | (header[2] << 8) | header[3];
+
+        vector<uint8_t> block(len);
+        if (!in_.read(reinterpret_cast<char *>(block.data()), len)) {
+            throw runtime_error{ BAD_FILE };
+        }
+        pos += 4 + len;
+
+        if (type == 0) {
+            // STREAMINFO
+            if (len < 34) {
+                throw runtime_error{ BAD_FILE };
+            }
+            const uint8_t *p = block.data();
+            minBlock_ = (p[0] << 8) | p[1];
+            maxBlock_ = (p[2] << 8) | p[3];
+            sampleRate_ = (p[10] << 12) | (p[11] << 4) | (p[12] >> 4);
+            nchannels_ = ((p[12] >> 1) & 7) + 1;
+            bps_ = (((p[12] & 1) << 4) | (p[13] >> 4)) + 1;
+            totalSamples_ = (uint64_t(p[13] & 0x0f) << 32) | (p[14] << 24) | (p[15] << 16) | (p[16] << 8) | p[17];
+            haveInfo = true;
+        } else if (type == 3) {
+            // SEEKTABLE; placeholder points have all ones for a sample
+            for (size_t i = 0; i + 18 <= len; i += 18) {
+                SeekPoint point{ 0, 0 };
+                for (int b = 0; b < 8; b++) {
+                    point.sample = (point.sample << 8) | block[i + b];
+                    point.offset = (point.offset << 8) | block[i + 8 + b];
+                }
+                if (point.sample != UINT64_MAX) {
+                    seekTable_.push_back(point);
+                }
+            }
+        }
+    }
+
+    if (!haveInfo) {
+        throw runtime_error{ BAD_FILE };
+    }
+
+    if (bps_ > 24) {
+        throw runtime_error{ "FLAC samples must be at most 24 bits." };
+    }
+
+    // no frame can be bigger than one with every sample stored as is,
+    // and the header
+    maxFrame_ = size_t(std::max<uint32_t>(maxBlock_, 1) * nchannels_) * (bps_ + 1) / 8 + MAX_HEADER + 64;
+
+    firstFrame_ = pos;
+}
+
+// Return a hash of the frame data and the channel being read. Must be
+// called before reading.
+//
+uint64_t FlacReader::hashData()
+{
+    const uint32_t CHUNK = 1 << 20;
+
+    ifstream in{ fname_, ios::binary };
+    in.seekg(firstFrame_);
+
+    // the same frames decode differently with another channel read
+    Hash64 hash;
+    int32_t layout[2] = { nchannels_, readChan_ };
+    hash.update(layout, sizeof(layout));
+
+    vector<char> buf(CHUNK);
+
+    while (in) {
+        in.read(buf.data(), CHUNK);
+        hash.update(buf.data(), in.gcount());
+    }
+
+    return hash.digest();
+}
+
+// Skip ahead by the given number of samples. If the seek table has a
+// point between here and there, jump to it rather than decoding all the
+// frames in between.
+//
+void FlacReader::skip(uint32_t nsamples)
+{
+    uint64_t target = pos_ + nsamples;
+    pos_ = target;
+
+    uint64_t decoded = current_.first + current_.samples.size();
+
+    const SeekPoint *best = nullptr;
+    for (auto &point : seekTable_) {
+        if (point.sample > decoded && point.sample <= target && (!best || point.sample > best->sample)) {
+            best = &point;
+        }
+    }
+
+    if (best) {
+        seekTo(*best);
+    }
+}
+
+// Drop everything buffered and start reading from a seek point
+void FlacReader::seekTo(const SeekPoint &point)
+{
+    if (next_.valid()) {
+        next_.wait();
+        next_ = std::future<Batch>{};
+    }
+
+    in_.clear();
+    in_.seekg(firstFrame_ + point.offset);
+    buf_.clear();
+    fileEof_ = false;
+
+    current_.samples.clear();
+    current_.first = point.sample;
+    current_.eof = false;
+    batchEnd_ = point.sample;
+    started_ = false;
+}
+
+// Sets the read channel, which is zero based.
+//
+void FlacReader::setReadChannel(int chan)
+{
+    if (chan < 0 || chan >= nchannels_) {
+        stringstream ss;
+        ss
+            << "attempt to set invalid read channel "
+            << chan
+            << " -- stream only has "
+            << nchannels_
+            << " channels.";
+        throw runtime_error{ ss.str() };
+    }
+
+    readChan_ = chan;
+}
+
+// Reads a block of samples of size `nsamples'. Fewer samples may
+// be returned. After all samples have been read, an empty vector
+// will be returned.
+//
+vector<int16_t> FlacReader::readSamples(uint32_t nsamples)
+{
+    vector<int16_t> data;
+    data.reserve(nsamples);
+
+    while (data.size() < nsamples) {
+        uint64_t end = current_.first + current_.samples.size();
+        if (pos_ >= end) {
+            if (current_.eof) {
+                break;
+            }
+            current_ = nextBatch();
+            continue;
+        }
+
+        size_t idx = pos_ - current_.first;
+        size_t n = std::min<size_t>(nsamples - data.size(), end - pos_);
+        data.insert(data.end(), current_.samples.begin() + idx, current_.samples.begin() + idx + n);
+        pos_ += n;
+    }
+
+    return data;
+}
+
+// Get the batch decoded in the background and start on the one after
+// it.
+//
+FlacReader::Batch FlacReader::nextBatch()
+{
+    if (!started_) {
+        next_ = std::async(std::launch::async, &FlacReader::decodeBatch, this);
+        started_ = true;
+    }
+
+    auto start = Clock::now();
+    Batch batch = next_.get();
+    ioWaitSeconds_ += Seconds{ Clock::now() - start }.count();
+
+    if (!batch.eof) {
+        next_ = std::async(std::launch::async, &FlacReader::decodeBatch, this);
+    }
+
+    return batch;
+}
+
+// Split the next run of frames out of the file and decode them.
+//
+FlacReader::Batch FlacReader::decodeBatch()
+{
+    struct Frame {
+        size_t start;
+        size_t end;
+        FrameHeader header;
+    };
+
+    vector<Frame> frames;
+    size_t pos = 0;
+    bool eof = false;
+
+    while (frames.size() < BATCH_FRAMES) {
+        Frame frame;
+        frame.start = findHeader(pos, frame.header);
+        if (frame.start == string::npos) {
+            eof = true;
+            break;
+        }
+
+        // The frame ends where the next one starts, but a sync code can
+        // turn up inside a frame, so the frame's CRC (over the whole
+        // frame including the CRC itself, which gives zero) has to check
+        // out too.
+        //
+        uint16_t crc = 0;
+        size_t crcPos = frame.start;
+        size_t cand = frame.start + frame.header.length;
+        FrameHeader next;
+
+        frame.end = string::npos;
+
+        while (true) {
+            cand = findHeader(cand + 1, next);
+            size_t end = cand == string::npos ? buf_.size() : cand;
+
+            for (; crcPos < end; crcPos++) {
+                crc = (crc << 8) ^ CRC.crc16[(crc >> 8) ^ buf_[crcPos]];
+            }
+
+            if (crc == 0) {
+                frame.end = end;
+                break;
+            }
+
+            if (cand == string::npos || end - frame.start > maxFrame_) {
+                break;
+            }
+        }
+
+        // A damaged frame is dropped, and the search for the next one
+        // starts just after it begins. 
+        if (frame.end == string::npos) {
+            pos = frame.start + 1;
+            continue;
+        }
+
+        frames.push_back(frame);
+        pos = frame.end;
+    }
+
+    // decode the frames across the threads
+    vector<vector<int16_t>> decoded(frames.size());
+    vector<string> errors(threads_);
+
+    auto work = [&](int t) {
+        try {
+            for (size_t i = t; i < frames.size(); i += threads_) {
+                const Frame &frame = frames[i];
+                decodeFrame(buf_.data() + frame.start, frame.end - frame.start, frame.header, decoded[i]);
+            }
+        } catch (runtime_error re) {
+            errors[t] = re.what();
+        }
+    };
+
+    if (threads_ == 1 || frames.size() < 2) {
+        work(0);
+    } else {
+        vector<thread> workers;
+        for (int t = 0; t < threads_; t++) {
+            workers.emplace_back(work, t);
+        }
+        for (auto &w : workers) {
+            w.join();
+        }
+    }
+
+    for (auto &err : errors) {
+        if (!err.empty()) {
+            throw runtime_error{ err };
+        }
+    }
+
+    // Dropped frames are replaced with silence so the timing of the rest
+    // of the tape isn't thrown off, unless the gap is implausibly long.
+    //
+    Batch batch;
+    batch.eof = eof;
+    batch.first = batchEnd_;
+    for (size_t i = 0; i < frames.size(); i++) {
+        uint64_t expected = batch.first + batch.samples.size();
+        uint64_t first = frames[i].header.first;
+        if (first > expected && first - expected <= MAX_GAP_FRAMES * uint64_t(maxBlock_)) {
+            batch.samples.insert(batch.samples.end(), first - expected, 0);
+        }
+        batch.samples.insert(batch.samples.end(), decoded[i].begin(), decoded[i].end());
+    }
+    batchEnd_ = batch.first + batch.samples.size();
+
+    buf_.erase(buf_.begin(), buf_.begin() + pos);
+    return batch;
+}
+
+// Make sure the buffer has at least `need' bytes if the file does.
+// Returns false if it doesn't.
+//
+bool FlacReader::fill(size_t need)
+{
+    while (buf_.size() < need && !fileEof_) {
+        size_t size = buf_.size();
+        buf_.resize(size + READ_CHUNK);
+        in_.read(reinterpret_cast<char *>(buf_.data() + size), READ_CHUNK);
+        buf_.resize(size + in_.gcount());
+
+        if (in_.eof()) {
+            fileEof_ = true;
+        } else if (!in_) {
+            throw runtime_error{ "failed reading FLAC file." };
+        }
+    }
+
+    return buf_.size() >= need;
+}
+
+// Find the next valid frame header at or after `from', or string::npos
+// if there are no more.
+//
+size_t FlacReader::findHeader(size_t from, FrameHeader &header)
+{
+    while (true) {
+        if (!fill(from + 2)) {
+            return string::npos;
+        }
+
+        const uint8_t *start = buf_.data() + from;
+        const uint8_t *p = static_cast<const uint8_t *>(memchr(start, 0xff, buf_.size() - from - 1));
+        if (p == nullptr) {
+            from = buf_.size() - 1;
+            continue;
+        }
+
+        size_t at = p - buf_.data();
+        if ((p[1] & 0xfe) == 0xf8) {
+            fill(at + MAX_HEADER);
+            if (parseHeader(buf_.data() + at, buf_.size() - at, header)) {
+                return at;
+            }
+        }
+
+        from = at + 1;
+    }
+}
+
+// Parse and check a frame header
+bool FlacReader::parseHeader(const uint8_t *p, size_t avail, FrameHeader &header) const
+{
+    static const int SAMPLE_SIZES[] = { 0, 8, 12, -1, 16, 20, 24, 32 };
+
+    if (avail < 6) {
+        return false;
+    }
+
+    bool variable = p[1] & 1;
+    int blockCode = p[2] >> 4;
+    int rateCode = p[2] & 0x0f;
+    int channels = p[3] >> 4;
+    int sizeCode = (p[3] >> 1) & 7;
+
+    if (blockCode == 0 || rateCode == 15 || channels > 10 || sizeCode == 3 || (p[3] & 1)) {
+        return false;
+    }
+
+    // the frame or sample number, UTF-8 style
+    size_t i = 4;
+    uint64_t number = p[i++];
+    int extra = 0;
+    if (number >= 0xfe) {
+        return false;
+    } else if (number >= 0xfc) {
+        number &= 0x01; extra = 5;
+    } else if (number >= 0xf8) {
+        number &= 0x03; extra = 4;
+    } else if (number >= 0xf0) {
+        number &= 0x07; extra = 3;
+    } else if (number >= 0xe0) {
+        number &= 0x0f; extra = 2;
+    } else if (number >= 0xc0) {
+        number &= 0x1f; extra = 1;
+    } else if (number >= 0x80) {
+        return false;
+    }
+
+    if (extra == 5 && !variable) {
+        return false;
+    }
+
+    for (int e = 0; e < extra; e++) {
+        if (i >= avail || (p[i] & 0xc0) != 0x80) {
+            return false;
+        }
+        number = (number << 6) | (p[i++] & 0x3f);
+    }
+
+    uint32_t blockSize;
+    if (blockCode == 1) {
+        blockSize = 192;
+    } else if (blockCode <= 5) {
+        blockSize = 576 << (blockCode - 2);
+    } else if (blockCode == 6) {
+        if (i + 1 > avail) {
+            return false;
+        }
+        blockSize = p[i++] + 1;
+    } else if (blockCode == 7) {
+        if (i + 2 > avail) {
+            return false;
+        }
+        blockSize = ((p[i] << 8) | p[i + 1]) + 1;
+        i += 2;
+    } else {
+        blockSize = 256 << (blockCode - 8);
+    }
+
+    if (rateCode == 12) {
+        i += 1;
+    } else if (rateCode == 13 || rateCode == 14) {
+        i += 2;
+    }
+
+    if (i + 1 > avail) {
+        return false;
+    }
+
+    uint8_t crc = 0;
+    for (size_t j = 0; j < i; j++) {
+        crc = CRC.crc8[crc ^ p[j]];
+    }
+    if (crc != p[i]) {
+        return false;
+    }
+
+    int nchannels = channels < 8 ? channels + 1 : 2;
+    int bps = sizeCode == 0 ? bps_ : SAMPLE_SIZES[sizeCode];
+    if (nchannels != nchannels_ || bps != bps_) {
+        return false;
+    }
+
+    header.length = i + 1;
+    header.blockSize = blockSize;
+    header.channelAssignment = channels;
+    header.bps = bps;
+    header.first = variable ? number : number * maxBlock_;
+
+    return true;
+}
+
+// Decode a whole frame, keeping the read channel as 16 bit samples
+void FlacReader::decodeFrame(const uint8_t *p, size_t len, const FrameHeader &header, vector<int16_t> &out) const
+{
+    uint32_t blockSize = header.blockSize;
+    int assignment = header.channelAssignment;
+
+    BitReader br{ p + header.length, len - header.length - 2 };
+
+    // Stereo may be coded as one channel and the difference between the
+    // channels, which needs an extra bit. In that case both are needed to
+    // recover either channel.
+    //
+    vector<vector<int32_t>> channels(nchannels_);
+    for (int ch = 0; ch < nchannels_; ch++) {
+        int bps = header.bps;
+        if ((assignment == 8 && ch == 1) || (assignment == 9 && ch == 0) || (assignment == 10 && ch == 1)) {
+            bps++;
+        }
+
+        channels[ch].resize(blockSize);
+        readSubframe(br, blockSize, bps, channels[ch].data());
+
+        // subframes for independent channels we don't want aren't needed
+        if (assignment < 8 && ch == readChan_) {
+            break;
+        }
+    }
+    br.check();
+
+    vector<int32_t> &left = channels[0];
+    vector<int32_t> &right = channels[nchannels_ > 1 ? 1 : 0];
+
+    switch (assignment) {
+    case 8:
+        // left, side
+        for (uint32_t i = 0; i < blockSize; i++) {
+            right[i] = left[i] - right[i];
+        }
+        break;
+
+    case 9:
+        // side, right
+        for (uint32_t i = 0; i < blockSize; i++) {
+            left[i] += right[i];
+        }
+        break;
+
+    case 10:
+        // mid, side
+        for (uint32_t i = 0; i < blockSize; i++) {
+            int32_t side = right[i];
+            int32_t mid = (left[i] << 1) | (side & 1);
+            left[i] = (mid + side) >> 1;
+            right[i] = (mid - side) >> 1;
+        }
+        break;
+    }
+
+    const vector<int32_t> &samples = channels[readChan_];
+    out.resize(blockSize);
+
+    for (uint32_t i = 0; i < blockSize; i++) {
+        int32_t s = samples[i];
+        out[i] = int16_t(bps_ >= 16 ? s >> (bps_ - 16) : s << (16 - bps_));
+    }
+}
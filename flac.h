@@ -0,0 +1,93 @@
+#ifndef FLAC_H
+#define FLAC_H
+
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "audio.h"
+
+// Reads a FLAC file, decoding frames as the samples are needed rather
+// than expanding the whole file first. Frames are found by their sync
+// code and checked with their CRC, which lets a batch of them be decoded
+// at once on several threads, while the next batch is decoded in the 
+// background. Skipping ahead uses the seek table if the file has one.
+//
+class FlacReader : public AudioReader {
+public:
+    FlacReader(const std::string &fname);
+    ~FlacReader();
+
+    int getSampleRate() const override { return sampleRate_; }
+    int getChannels() const override { return nchannels_; }
+    uint32_t getSampleCount() const override { return totalSamples_; }
+
+    uint64_t hashData() override;
+
+    void skip(uint32_t nsamples) override;
+    void setReadChannel(int chan) override;
+    std::vector<int16_t> readSamples(uint32_t nsamples) override;
+
+    double getIoWaitSeconds() const override { return ioWaitSeconds_; }
+
+private:
+    struct SeekPoint {
+        uint64_t sample;
+        uint64_t offset;    // from the first frame
+    };
+
+    // the decoded samples of the read channel from a run of frames
+    struct Batch {
+        std::vector<int16_t> samples;
+        uint64_t first;     // sample number of samples[0]
+        bool eof;
+    };
+
+    struct FrameHeader {
+        int length;
+        uint32_t blockSize;
+        int channelAssignment;
+        int bps;
+        uint64_t first;
+    };
+
+    std::string fname_;
+    std::ifstream in_;
+    int sampleRate_;
+    int nchannels_;
+    int bps_;
+    int readChan_;
+    uint64_t totalSamples_;
+    uint32_t minBlock_;
+    uint32_t maxBlock_;
+    uint64_t firstFrame_;
+    std::vector<SeekPoint> seekTable_;
+    size_t maxFrame_;
+    int threads_;
+
+    // file data not yet split into frames, and the number of the sample 
+    // after the last batch decoded
+    std::vector<uint8_t> buf_;
+    bool fileEof_;
+    uint64_t batchEnd_;
+
+    bool started_;
+    std::future<Batch> next_;
+    Batch current_;
+    uint64_t pos_;
+    double ioWaitSeconds_;
+
+    void readMetadata();
+    void seekTo(const SeekPoint &point);
+
+    Batch decodeBatch();
+    bool fill(size_t need);
+    size_t findHeader(size_t from, FrameHeader &header);
+    bool parseHeader(const uint8_t *p, size_t avail, FrameHeader &header) const;
+    void decodeFrame(const uint8_t *p, size_t len, const FrameHeader &header, std::vector<int16_t> &out) const;
+    Batch nextBatch();
+};
+
+#endif
@@ -1,30 +1,92 @@
 #include "frameflt.h"
 
-#include "bitstrm.h"
+#include "perfctr.h"
+#include "probes.h"
+#include "stage.h"
+#include "tracer.h"
 
+#include <algorithm>
 #include <vector>
 
 using std::vector;
 
-FrameFilter::FrameFilter(BitstreamFilter &bs)
-    : bs_(bs)
-    , bitIdx_(0)
-    , eof_(false)
+namespace {
+    // A character is rated mostly by where it starts. Characters follow
+    // each other a character period apart. A start closer than SHORT_GAP
+    // periods to the one before means one of them is spurious, and one
+    // further than LONG_GAP means characters in between were lost, unless
+    // it's a pause of more than PAUSE. The rating falls to zero by
+    // GAP_SLOPE beyond either limit. The period is tracked from gaps within
+    // the limits, moving 1/PERIOD_SMOOTH of the way each time, and is taken
+    // again from a character's own bits after RESEED gaps in a row outside
+    // them, in case the character it was first taken from was a bad one.
+    //
+    const double SHORT_GAP = 0.85;
+    const double LONG_GAP = 1.15;
+    const double GAP_SLOPE = 0.25;
+    const double PAUSE = 4.5;
+    const double PERIOD_SMOOTH = 8;
+    const int RESEED = 4;
+
+    // The evidence behind the bits takes off up to EVIDENCE_WEIGHT more,
+    // which is too little to mark a character as doubtful on its own: an
+    // off-speed tape has poor evidence throughout but mostly good text.
+    // Cycles out to EDGE_OK of the way to the edge of their band, and
+    // spans up to CLOCK_OK of a clock off a whole number of clocks, are
+    // what a clean tape gives and count for nothing; beyond that the
+    // evidence falls to zero at the edge of the band or half a clock off.
+    // Each noise span merged into a bit's span divides it further.
+    //
+    const double EVIDENCE_WEIGHT = 0.4;
+    const double EDGE_OK = 0.7;
+    const double CLOCK_OK = 0.1;
+}
+
+FrameFilter::FrameFilter(BitSource &bs, int window)
+    : bits_(bs, window)
+    , trace_(nullptr)
+    , flush_(false)
     , ringBase_(0)
+    , lastStart_(-1)
+    , period_(0)
+    , misses_(0)
+    , accepted_(0)
+    , rejected_(0)
+    , printable_(0)
 {
-    bits_ = bs.getBits(WINDOW);
-
     for (int i = 0; i < FRAME; i++) {
-        ring_[i] = getNextBit();
+        ring_[i] = getNextBit(timeRing_[i], evidenceRing_[i]);
     }   
 }
 
+// Enable tracing
+void FrameFilter::trace(TraceRing &ring)
+{
+    trace_ = &ring;
+}
+
+// Return as soon as the buffered bits are used up, rather than
+// waiting for a full block of characters
+void FrameFilter::flush()
+{
+    flush_ = true;
+}
+
 // Return some decoded character data
 vector<char> FrameFilter::getChars(int nchars)
 {
+    PerfScope scope{ PerfCounters::Frame };
+    OSIWAVE_PROBE1(chars_entry, nchars);
+
     vector<char> chars;
+    positions_.clear();
+    confidences_.clear();
+
+    while (chars.size() < nchars && !bits_.eof()) {
+        if (flush_ && chars.size() && bits_.drained()) {
+            break;
+        }
 
-    while (chars.size() < nchars && !eof_) {
         // frame format is
         //           1
         // 01234567890
@@ -42,16 +104,29 @@ vector<char> FrameFilter::getChars(int nchars)
             // kind of hacky, we are specifically looking for ASCII data so
             // throw away false positives based on the encoding.
             if (ch == '\r' || ch == '\n' || ch == '\0' || (ch >= 0x20 && ch <= 0x7e)) {
+                if (trace_) {
+                    trace_->record(TraceEvent::FrameAccept, timeAt(1), uint8_t(ch));
+                }
                 chars.push_back(ch);
+                positions_.push_back(Position{ timeAt(1), timeAt(10) });
+                confidences_.push_back(timing(timeAt(1), timeAt(10)) * (1 - EVIDENCE_WEIGHT * (1 - evidence())));
+                accepted_++;
+                printable_ += ch != '\0';
                 refillFrame();
                 continue;
             }
+
+            if (trace_) {
+                trace_->record(TraceEvent::FrameReject, timeAt(1), uint8_t(ch));
+            }
+            rejected_++;
         }
 
         frameShift();
         continue;
     }
 
+    OSIWAVE_PROBE2(chars_return, nchars, chars.size());
     return chars;
 }
 
@@ -62,41 +137,91 @@ bool FrameFilter::frameAt(int idx) const
     return ring_[(ringBase_ + idx) % FRAME];
 }
 
-// shift one new bit in the frame buffer
-void FrameFilter::frameShift()
+// return the time of the bit at position `idx' in the candidate frame
+double FrameFilter::timeAt(int idx) const
 {
-    ring_[ringBase_] = getNextBit();
-    ringBase_ = (ringBase_ + 1) % FRAME;
+    return timeRing_[(ringBase_ + idx) % FRAME];
 }
 
-// refill the entire frame except for the MARK at the end
-void FrameFilter::refillFrame()
+// How good the evidence for the character in the frame is, from 0 to 1:
+// as good as for the least trustworthy of its bits, from the start bit
+// to the stop bit
+double FrameFilter::evidence() const
 {
-    ring_[0] = ring_.back();
+    double edge = 0;
+    int noise = 0;
+    double offClock = 0;
+
     for (int i = 1; i < FRAME; i++) {
-        ring_[i] = getNextBit();
+        const SpanSource::Evidence &e = evidenceRing_[(ringBase_ + i) % FRAME];
+        edge = std::max(edge, e.edge);
+        noise = std::max(noise, e.noise);
+        offClock = std::max(offClock, e.offClock);
     }
-    ringBase_ = 0;
+
+    double edgeScore = std::min(1.0, std::max(0.0, (1 - edge) / (1 - EDGE_OK)));
+    double clockScore = std::min(1.0, std::max(0.0, (0.5 - offClock) / (0.5 - CLOCK_OK)));
+    return edgeScore * clockScore / (1 + noise);
 }
 
-// Get the next buffered bit
-bool FrameFilter::getNextBit()
+// How well a character starting at `start', with its stop bit at `stop',
+// follows the one before, from 0 to 1. Without bit times, every
+// character is rated 1.
+//
+double FrameFilter::timing(double start, double stop)
 {
-    if (eof_) {
-        return false;
+    double last = lastStart_;
+    lastStart_ = start;
+
+    // the start bit to the stop bit is all but two bits of a character
+    if (period_ <= 0 || misses_ >= RESEED) {
+        period_ = (stop - start) * FRAME / (FRAME - 2);
+        misses_ = 0;
+    }
+    if (last < 0 || period_ <= 0) {
+        return 1;
     }
 
-    if (bitIdx_ < bits_.size()) {
-        return bits_[bitIdx_++];
+    double gap = (start - last) / period_;
+    if (gap > PAUSE) {
+        return 1;
     }
+    if (gap >= SHORT_GAP && gap <= LONG_GAP) {
+        period_ += (start - last - period_) / PERIOD_SMOOTH;
+        misses_ = 0;
+        return 1;
+    }
+
+    misses_++;
+    double off = gap < SHORT_GAP ? SHORT_GAP - gap : gap - LONG_GAP;
+    return std::max(0.0, 1 - off / GAP_SLOPE);
+}
 
-    bits_ = bs_.getBits(WINDOW);
-    bitIdx_ = 0;
+// shift one new bit in the frame buffer
+void FrameFilter::frameShift()
+{
+    ring_[ringBase_] = getNextBit(timeRing_[ringBase_], evidenceRing_[ringBase_]);
+    ringBase_ = (ringBase_ + 1) % FRAME;
+}
 
-    if (bits_.size() == 0) {
-        eof_ = true;
-        return false;
+// refill the entire frame except for the MARK at the end
+void FrameFilter::refillFrame()
+{
+    int last = (ringBase_ + FRAME - 1) % FRAME;
+    ring_[0] = ring_[last];
+    timeRing_[0] = timeRing_[last];
+    evidenceRing_[0] = evidenceRing_[last];
+    for (int i = 1; i < FRAME; i++) {
+        ring_[i] = getNextBit(timeRing_[i], evidenceRing_[i]);
     }
+    ringBase_ = 0;
+}
 
-    return getNextBit();
+// Get the next buffered bit, and its time and evidence if known
+bool FrameFilter::getNextBit(double &time, SpanSource::Evidence &evidence)
+{
+    TimedBit bit = bits_.next();
+    time = bit.time;
+    evidence = bit.evidence;
+    return bit.bit;
 }
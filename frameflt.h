@@ -2,34 +2,80 @@
 #define FRAMEFLT_H
 
 #include <array>
+#include <cstdint>
 #include <vector>
 
-class BitstreamFilter;
+#include "blockrd.h"
+#include "stage.h"
+
+class TraceRing;
 
 class FrameFilter {
 public:
-    FrameFilter(BitstreamFilter &bs);
+    // where a character was found in the stream, as the times in seconds
+    // of its start and stop bits
+    struct Position {
+        double start;
+        double stop;
+    };
+
+    FrameFilter(BitSource &bs, int window = 1024);
 
+    void trace(TraceRing &ring);
+    void flush();
     std::vector<char> getChars(int nchars);
 
-private:
-    const int WINDOW = 1024;
+    // The positions of the characters returned by the last call to 
+    // getChars, if the bit source provides bit times.
+    const std::vector<Position> &getPositions() const { return positions_; }
+
+    // And how sure the filter is of each, from 0 to 1: mostly by how far
+    // its start is from the last character's, since a gap of more than a
+    // character's time means characters were lost and less means one is
+    // spurious, and then by the evidence behind its bits. Without evidence
+    // and times from the bit source, every character is rated 1.
+    //
+    const std::vector<double> &getConfidences() const { return confidences_; }
+
+    // How many candidate frames have been accepted and rejected so far,
+    // and how many of those accepted were printable (not NUL)
+    uint64_t getAccepted() const { return accepted_; }
+    uint64_t getRejected() const { return rejected_; }
+    uint64_t getPrintable() const { return printable_; }
 
+private:
     static const int FRAME = 11;
     
-    BitstreamFilter &bs_;
-    std::vector<bool> bits_;
-    int bitIdx_;
-    bool eof_;
+    BlockReader<BitSource> bits_;
+    TraceRing *trace_;
+    bool flush_;
 
     std::array<bool, FRAME> ring_;
+    std::array<double, FRAME> timeRing_;
+    std::array<SpanSource::Evidence, FRAME> evidenceRing_;
     int ringBase_;
 
+    // the start time of the last character, the character period, and
+    // how many gaps in a row haven't fitted it
+    double lastStart_;
+    double period_;
+    int misses_;
+
+    std::vector<Position> positions_;
+    std::vector<double> confidences_;
+
+    uint64_t accepted_;
+    uint64_t rejected_;
+    uint64_t printable_;
+
     bool frameAt(int idx) const;
+    double timeAt(int idx) const;
+    double evidence() const;
+    double timing(double start, double stop);
     void frameShift();
     void refillFrame();
 
-    bool getNextBit();
+    bool getNextBit(double &time, SpanSource::Evidence &evidence);
 };
 
 #endif
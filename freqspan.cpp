@@ -1,18 +1,17 @@
 #include "freqspan.h"
 
-#include "xcross.h"
+#include "perfctr.h"
+#include "probes.h"
+#include "tracer.h"
 
-#include <iomanip>
-#include <iostream>
+#include <algorithm>
 #include <string>
 #include <vector>
 
-using std::cout;
-using std::endl;
 using std::string;
 using std::vector;
 
-string FreqSpanFilter::valueName(Value v)
+string SpanSource::valueName(Value v)
 {
     switch(v) {
         case Mark: return "mark";
@@ -22,101 +21,82 @@ string FreqSpanFilter::valueName(Value v)
 }
 
 
-FreqSpanFilter::FreqSpanFilter(ZeroCrossFilter &zc)
-    : zc_(zc)
-    , trace_(false)
-    , eof_(false)
-    , zeroCrossingIdx_(0)
+FreqSpanFilter::FreqSpanFilter(CrossingSource &zc, int window)
+    : crossings_(zc, window)
+    , trace_(nullptr)
+    , flush_(false)
+    , first_(true)
+    , start_(0)
+    , value_(Noise)
+    , edge_(0)
 {
-    zeroCrossings_ = zc_.getTimestamps(WINDOW);
-    prevTimestamp_ = getNextZeroCrossing();
-    currTimestamp_ = getNextZeroCrossing();
+    prevTimestamp_ = crossings_.next();
+    currTimestamp_ = crossings_.next();
+    start_ = prevTimestamp_;
 }
 
 // Enable tracing
-void FreqSpanFilter::trace()
+void FreqSpanFilter::trace(TraceRing &ring)
 {
-    trace_ = true;
+    trace_ = &ring;
+}
+
+// Return as soon as the buffered crossings are used up, rather than
+// waiting for a full block of spans
+void FreqSpanFilter::flush()
+{
+    flush_ = true;
+}
+
+// Enable tracking of tape speed
+void FreqSpanFilter::adapt()
+{
+    bands_.adapt();
 }
 
 // Given zero crossings from the stream, make spans of similar frequency
-// in terms of RS-232 marks and spaces.
+// in terms of RS-232 marks and spaces. The span in progress is carried
+// over between calls, so the spans don't depend on the block size.
 //
 vector<FreqSpanFilter::Span> FreqSpanFilter::getSpans(int nspans)
 {
-    vector<Span> spans;
-
-    bool first = true;
-    double start = prevTimestamp_;
-    Value value = Noise;
+    PerfScope scope{ PerfCounters::FreqSpan };
+    OSIWAVE_PROBE1(freqspans_entry, nspans);
 
-    if (trace_) {
-        cout << "frequency spans" << endl;
-        cout << "prev " << prevTimestamp_ << endl;
-    }
+    vector<Span> spans;
 
-    while (spans.size() < nspans && !eof_) {
-        if (trace_) {
-            cout << "curr " << currTimestamp_ << endl;
+    while (spans.size() < nspans && !crossings_.eof()) {
+        if (flush_ && spans.size() && crossings_.drained()) {
+            break;
         }
+
         double dt = currTimestamp_ - prevTimestamp_;
         double freq = 1.0 / dt;
 
-        Value nextValue = Noise;
-
-        // The nominal frequencies are 1200/2400 hz, but things
-        // like tape speed, warble, and the waveform not being exactly 
-        // centered mean we need to look at ranges.
-        //
-        if (freq > 2100 && freq < 2550) {
-            nextValue = Mark;
-        } else if (freq >= 1100 && freq < 1550) {
-            nextValue = Space;
-        }
+        Value nextValue = bands_.classify(freq);
         
-        if (nextValue != value) {
-            if (!first) {
-                double dt = currTimestamp_ - start;
-                if (trace_) {
-                    cout << "  " << freq << "  " << valueName(value) << " -> " << valueName(nextValue) << dt << endl;
-                }
-                spans.push_back(Span{ value, dt });
+        if (nextValue != value_) {
+            if (!first_) {
+                double dt = prevTimestamp_ - start_;
+                spans.push_back(Span{ value_, start_, dt, 0, bands_.getClock(), Evidence{ edge_, 0, 0 } });
             } else {  
-                if (trace_) {
-                    cout << "first" << endl;
-                }
-                first = false;
+                first_ = false;
+            }
+            if (trace_) {
+                trace_->record(TraceEvent::SpanChange, prevTimestamp_, freq, value_, nextValue);
             }
-            value = nextValue;
-            start = prevTimestamp_;
+            value_ = nextValue;
+            start_ = prevTimestamp_;
+            edge_ = 0;
+        }
+        if (nextValue != Noise) {
+            edge_ = std::max(edge_, bands_.getEdge());
         }
 
         prevTimestamp_ = currTimestamp_;
-        currTimestamp_ = getNextZeroCrossing();
+        currTimestamp_ = crossings_.next();
     }
 
+    OSIWAVE_PROBE2(freqspans_return, nspans, spans.size());
     return spans;
 }
-
-
-// Get the next buffered zero crossing.
-double FreqSpanFilter::getNextZeroCrossing()
-{
-    if (eof_) {
-        return 0.0;
-    }
-    
-    if (zeroCrossingIdx_ < zeroCrossings_.size()) {
-        return zeroCrossings_[zeroCrossingIdx_++];
-    }
-
-    zeroCrossings_ = zc_.getTimestamps(WINDOW);
-
-    if (zeroCrossings_.size() == 0) {
-        eof_ = true;
-        return 0.0;
-    }
-
-    zeroCrossingIdx_ = 0;
-    return zeroCrossings_[zeroCrossingIdx_++];
-}      
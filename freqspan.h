@@ -4,43 +4,35 @@
 #include <string>
 #include <vector>
 
-class ZeroCrossFilter;
+#include "bandtrk.h"
+#include "blockrd.h"
+#include "stage.h"
 
-class FreqSpanFilter {
-public:
-    // a value decoded from the analog data
-    enum Value {
-        Space,   // 1200 hz => zero/space 
-        Mark,    // 2400 hz => one/mark
-        Noise,   // anything else
-    };
-
-    static std::string valueName(Value v);
+class TraceRing;
 
-    // a span of one detected value in the analog data
-    struct Span {
-        Value value;
-        double length;
-        int clocks;
-    };
-
-    FreqSpanFilter(ZeroCrossFilter &zc);
+class FreqSpanFilter : public SpanSource {
+public:
+    FreqSpanFilter(CrossingSource &zc, int window = 1024);
 
-    void trace();
-    std::vector<Span> getSpans(int nspans);
+    void trace(TraceRing &ring);
+    void flush();
+    void adapt();
+    std::vector<Span> getSpans(int nspans) override;
 
 private:
-    const int WINDOW = 1024;
-    
-    ZeroCrossFilter &zc_;
-    bool trace_;
-    bool eof_;
-    std::vector<double> zeroCrossings_;
-    int zeroCrossingIdx_;
+    BlockReader<CrossingSource> crossings_;
+    TraceRing *trace_;
+    bool flush_;
+    BandTracker bands_;
     double prevTimestamp_;
     double currTimestamp_;
 
-    double getNextZeroCrossing();
+    // the span in progress, and the nearest its cycles have come to the
+    // edge of the band
+    bool first_;
+    double start_;
+    Value value_;
+    double edge_;
 };
 
 #endif
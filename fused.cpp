@@ -0,0 +1,355 @@
+#include "fused.h"
+
+#include "latency.h"
+#include "perfctr.h"
+#include "probes.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using std::runtime_error;
+using std::vector;
+
+FusedFrontEnd::FusedFrontEnd(SampleSource &source, int dcwin, DCFilter::Mode mode, bool negate, int window)
+    : samples_(source, window)
+    , meter_(nullptr)
+    , crossingTrace_(nullptr)
+    , spanTrace_(nullptr)
+    , flush_(false)
+    , secPerSample_(1.0 / source.getSampleRate())
+    , rawSamples_(0)
+    , window_(dcwin)
+    , mode_(mode)
+    , shift_(DCFilter::poleShift(dcwin))
+    , in_(0)
+    , sum_(0)
+    , negate_(negate)
+    , sampleTime_(0)
+    , inRun_(false)
+    , runStart_(0)
+    , crossings_(0)
+    , prevTimestamp_(0)
+    , first_(true)
+    , start_(0)
+    , value_(Noise)
+    , edge_(0)
+    , spanIdx_(0)
+{
+    if (window_ <= 0 || window <= 0) {
+        throw runtime_error{ "invalid DC window." };
+    }
+
+    dc_[0] = dc_[1] = 0;
+
+    if (mode_ == DCFilter::Average) {
+        ring_.resize(window_);
+    }
+
+    // A block of filtered samples may be a whole block from the source
+    // or what's left in the window at end of file. The two carried over
+    // start out non-zero so they don't look like a run of zeroes.
+    //
+    size_t nrows = std::max(window, window_);
+    rows_.assign(nrows + 2, 1);
+    flags_.resize((nrows + 7) / 8 * 8);
+}
+
+// Report the arrival of each block of samples to `meter'
+void FusedFrontEnd::meter(LatencyMeter &meter)
+{
+    meter_ = &meter;
+}
+
+// Trace each crossing, as ZeroCrossFilter does
+void FusedFrontEnd::traceCrossings(TraceRing &ring)
+{
+    crossingTrace_ = &ring;
+}
+
+// Trace each change of span, as FreqSpanFilter does
+void FusedFrontEnd::traceSpans(TraceRing &ring)
+{
+    spanTrace_ = &ring;
+}
+
+// Return as soon as the buffered samples are used up, rather than
+// waiting for a full block of spans
+void FusedFrontEnd::flush()
+{
+    flush_ = true;
+}
+
+// Enable tracking of tape speed
+void FusedFrontEnd::adapt()
+{
+    bands_.adapt();
+}
+
+// Run blocks of samples through until there are enough spans. A block
+// may end more spans than were asked for; the rest are kept for the
+// next call.
+//
+vector<FusedFrontEnd::Span> FusedFrontEnd::getSpans(int nspans)
+{
+    PerfScope scope{ PerfCounters::Fused };
+    OSIWAVE_PROBE1(freqspans_entry, nspans);
+
+    while (spans_.size() - spanIdx_ < nspans && !samples_.eof()) {
+        if (flush_ && spans_.size() > spanIdx_) {
+            break;
+        }
+
+        if (!samples_.refill()) {
+            finish();
+            break;
+        }
+
+        int16_t *rows = rows_.data() + 2;
+        uint32_t nrows = mode_ == DCFilter::Average
+            ? average(samples_.begin(), samples_.end(), rows)
+            : highPass(samples_.begin(), samples_.end(), rows);
+        samples_.consume(samples_.end() - samples_.begin());
+        scan(nrows);
+
+        if (meter_) {
+            meter_->samplesArrived(rawSamples_);
+        }
+    }
+
+    size_t n = std::min<size_t>(nspans, spans_.size() - spanIdx_);
+    vector<Span> out(spans_.begin() + spanIdx_, spans_.begin() + spanIdx_ + n);
+    spanIdx_ += n;
+
+    if (spanIdx_ == spans_.size()) {
+        spans_.clear();
+        spanIdx_ = 0;
+    }
+
+    OSIWAVE_PROBE2(freqspans_return, nspans, out.size());
+    return out;
+}
+
+// Remove DC from a block of samples by subtracting a moving average, as
+// DCFilter does, writing the samples which come out to `rows'. The first
+// half window goes out unfiltered. Returns the number of rows.
+//
+uint32_t FusedFrontEnd::average(const int16_t *begin, const int16_t *end, int16_t *rows)
+{
+    const uint32_t window = window_;
+    const uint32_t half = window / 2;
+    const double dwindow = window;
+    int16_t *y = rows;
+
+    for (const int16_t *p = begin; p != end; p++, rawSamples_++) {
+        int16_t x = *p;
+
+        if (rawSamples_ < window) {
+            ring_[rawSamples_] = x;
+            sum_ += x;
+            if (rawSamples_ < half) {
+                *y++ = x;
+            }
+            continue;
+        }
+
+        // the average is divided in double precision, which truncates
+        // to the same integer as dividing the sum directly but is faster
+        uint32_t out = in_ + half;
+        if (out >= window) {
+            out -= window;
+        }
+
+        int32_t avg = static_cast<int32_t>(sum_ / dwindow);
+        *y++ = static_cast<int16_t>(ring_[out] - avg);
+
+        sum_ += x - ring_[in_];
+        ring_[in_] = x;
+        if (++in_ == window) {
+            in_ = 0;
+        }
+    }
+
+    return y - rows;
+}
+
+// Remove DC from a block of samples with the high-pass filter, writing
+// every sample straight out to `rows'
+uint32_t FusedFrontEnd::highPass(const int16_t *begin, const int16_t *end, int16_t *rows)
+{
+    const int shift = shift_;
+
+    if (begin != end && rawSamples_ == 0) {
+        dc_[0] = DCFilter::primePole(*begin);
+    }
+    rawSamples_ += end - begin;
+
+    for (const int16_t *p = begin; p != end; p++) {
+        int32_t y = DCFilter::pole(*p, dc_[0], shift);
+        if (mode_ == DCFilter::TwoPole) {
+            y = DCFilter::pole(y, dc_[1], shift);
+        }
+        *rows++ = DCFilter::clamp(y);
+    }
+
+    return end - begin;
+}
+
+// Look for crossings in the first `nrows' filtered samples. As in the
+// lane front end, the samples which might end a crossing or a run of
+// zeroes are flagged in one pass the compiler can vectorize, and only
+// those are checked properly, eight flags at a time.
+//
+void FusedFrontEnd::scan(uint32_t nrows)
+{
+    const int16_t *p2 = rows_.data();
+    const int16_t *p1 = p2 + 1;
+    const int16_t *y = p1 + 1;
+    uint8_t *flags = flags_.data();
+
+    if (negate_) {
+        for (uint32_t i = 0; i < nrows; i++) {
+            flags[i] = (p1[i] == 0) | (p2[i] == 0) | ((p1[i] > 0) & (y[i] < 0));
+        }
+    } else {
+        for (uint32_t i = 0; i < nrows; i++) {
+            flags[i] = (p1[i] == 0) | (p2[i] == 0) | ((p1[i] < 0) & (y[i] > 0));
+        }
+    }
+    std::fill(flags + nrows, flags + flags_.size(), 0);
+
+    for (uint32_t i = 0; i < nrows; i += 8) {
+        uint64_t word;
+        memcpy(&word, flags + i, sizeof(word));
+        if (word == 0) {
+            continue;
+        }
+
+        for (uint32_t j = i; j < i + 8; j++) {
+            if (flags[j]) {
+                checkPair(p1[j], y[j], sampleTime_ + j);
+            }
+        }
+    }
+
+    sampleTime_ += nrows;
+    std::copy(rows_.begin() + nrows, rows_.begin() + nrows + 2, rows_.begin());
+}
+
+// At end of file, filter what's left in the window with the final
+// average and end any run of zeroes. A stream too short to fill the
+// window goes out unfiltered.
+//
+void FusedFrontEnd::finish()
+{
+    if (mode_ == DCFilter::Average) {
+        const uint32_t window = window_;
+        const uint32_t half = window / 2;
+        int16_t *rows = rows_.data() + 2;
+        uint32_t nrows = 0;
+
+        if (rawSamples_ < window) {
+            for (uint64_t i = half; i < rawSamples_; i++) {
+                rows[nrows++] = ring_[i];
+            }
+        } else {
+            // (a window of one leaves nothing behind)
+            int32_t avg = sum_ / window_;
+            for (uint64_t i = rawSamples_ - (window - half) % window; i < rawSamples_; i++) {
+                rows[nrows++] = static_cast<int16_t>(ring_[i % window] - avg);
+            }
+        }
+
+        scan(nrows);
+    }
+
+    // a run of zeroes at the very end still counts
+    if (inRun_) {
+        runCrossing(sampleTime_);
+    }
+}
+
+// Check the pair of filtered samples `l' and `r' for a crossing, where
+// `r' is sample `k' of the stream, as ZeroCrossFilter does.
+//
+void FusedFrontEnd::checkPair(int l, int r, uint64_t k)
+{
+    if (k == 0) {
+        return;
+    }
+
+    if (l == 0) {
+        if (!inRun_) {
+            inRun_ = true;
+            runStart_ = k - 1;
+        }
+        return;
+    }
+
+    if (inRun_) {
+        runCrossing(k - 1);
+    }
+
+    double t;
+    if (negate_ && l > 0 && r < 0) {
+        t = double(l) / double(l - r);
+    } else if (!negate_ && l < 0 && r > 0) {
+        t = double(-l) / double(r - l);
+    } else {
+        return;
+    }
+
+    t = (k + t) * secPerSample_;
+    if (crossingTrace_) {
+        crossingTrace_->record(TraceEvent::Crossing, t, 0);
+    }
+    crossing(t);
+}
+
+// End the run of zeroes in progress at sample `end', with a crossing in
+// the middle of it
+void FusedFrontEnd::runCrossing(uint64_t end)
+{
+    double t = secPerSample_ * (runStart_ + (end - runStart_) * 0.5);
+    if (crossingTrace_) {
+        crossingTrace_->record(TraceEvent::Crossing, t, 1);
+    }
+    inRun_ = false;
+    crossing(t);
+}
+
+// Classify the cycle ending with the crossing at time `t', ending the
+// span in progress if it's a different value, as FreqSpanFilter does.
+//
+void FusedFrontEnd::crossing(double t)
+{
+    if (crossings_++ == 0) {
+        prevTimestamp_ = t;
+        start_ = t;
+        return;
+    }
+
+    double freq = 1.0 / (t - prevTimestamp_);
+    Value nextValue = bands_.classify(freq);
+
+    if (nextValue != value_) {
+        if (!first_) {
+            spans_.push_back(Span{ value_, start_, prevTimestamp_ - start_, 0, bands_.getClock(), Evidence{ edge_, 0, 0 } });
+        } else {
+            first_ = false;
+        }
+        if (spanTrace_) {
+            spanTrace_->record(TraceEvent::SpanChange, prevTimestamp_, freq, value_, nextValue);
+        }
+        value_ = nextValue;
+        start_ = prevTimestamp_;
+        edge_ = 0;
+    }
+    if (nextValue != Noise) {
+        edge_ = std::max(edge_, bands_.getEdge());
+    }
+
+    prevTimestamp_ = t;
+}
@@ -0,0 +1,85 @@
+#ifndef FUSED_H
+#define FUSED_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bandtrk.h"
+#include "blockrd.h"
+#include "dcfilter.h"
+#include "stage.h"
+
+class LatencyMeter;
+class TraceRing;
+
+// Does the work of DCFilter, ZeroCrossFilter and FreqSpanFilter in one
+// pass over each block of raw samples. Each sample has DC removed and is
+// checked for a crossing while it's still in a register, and each
+// crossing is classified as soon as it's found, so neither the filtered
+// samples nor the crossings are ever stored. The spans are exactly the
+// same as those of the separate stages, which are kept as the reference
+// (see -V).
+//
+class FusedFrontEnd : public SpanSource {
+public:
+    FusedFrontEnd(SampleSource &source, int dcwin, DCFilter::Mode mode, bool negate, int window = 4096);
+
+    void meter(LatencyMeter &meter);
+    void traceCrossings(TraceRing &ring);
+    void traceSpans(TraceRing &ring);
+    void flush();
+    void adapt();
+    std::vector<Span> getSpans(int nspans) override;
+
+    uint64_t getSampleCount() const { return rawSamples_; }
+
+private:
+    BlockReader<SampleSource> samples_;
+    LatencyMeter *meter_;
+    TraceRing *crossingTrace_;
+    TraceRing *spanTrace_;
+    bool flush_;
+    double secPerSample_;
+    uint64_t rawSamples_;
+
+    // DC removal, as in DCFilter
+    int window_;
+    DCFilter::Mode mode_;
+    int shift_;
+    std::vector<int16_t> ring_;
+    uint32_t in_;
+    int32_t sum_;
+    int32_t dc_[2];
+
+    // crossing detection, as in ZeroCrossFilter. The filtered samples
+    // of a block follow the last two of the block before in rows_.
+    //
+    bool negate_;
+    std::vector<int16_t> rows_;
+    std::vector<uint8_t> flags_;
+    uint64_t sampleTime_;
+    bool inRun_;
+    uint64_t runStart_;
+
+    // span building, as in FreqSpanFilter
+    BandTracker bands_;
+    uint64_t crossings_;
+    double prevTimestamp_;
+    bool first_;
+    double start_;
+    Value value_;
+    double edge_;
+
+    std::vector<Span> spans_;
+    size_t spanIdx_;
+
+    uint32_t average(const int16_t *begin, const int16_t *end, int16_t *rows);
+    uint32_t highPass(const int16_t *begin, const int16_t *end, int16_t *rows);
+    void scan(uint32_t nrows);
+    void finish();
+    void checkPair(int l, int r, uint64_t k);
+    void runCrossing(uint64_t end);
+    void crossing(double t);
+};
+
+#endif
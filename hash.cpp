@@ -0,0 +1,104 @@
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    const uint64_t K0 = 0x9e3779b97f4a7c15ull;
+    const uint64_t K1 = 0xc2b2ae3d27d4eb4full;
+    const uint64_t K2 = 0x165667b19e3779f9ull;
+
+    uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    uint64_t load64(const uint8_t *p)
+    {
+        uint64_t w = 0;
+        for (int i = 7; i >= 0; i--) {
+            w = (w << 8) | p[i];
+        }
+        return w;
+    }
+
+    uint64_t fmix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= K1;
+        h ^= h >> 29;
+        h *= K2;
+        h ^= h >> 32;
+        return h;
+    }
+}
+
+Hash64::Hash64(uint64_t seed)
+    : tailLen_(0)
+    , total_(0)
+{
+    for (int i = 0; i < LANES; i++) {
+        lanes_[i] = seed + K0 * (i + 1);
+    }
+}
+
+// Add some data to the hash. The data is consumed in blocks of 32 bytes,
+// one 64-bit word per independent lane so the multiplies can overlap.
+//
+void Hash64::update(const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    const size_t BLOCK = sizeof(tail_);
+
+    total_ += len;
+
+    if (tailLen_) {
+        size_t n = std::min(len, BLOCK - tailLen_);
+        memcpy(tail_ + tailLen_, p, n);
+        tailLen_ += n;
+        p += n;
+        len -= n;
+
+        if (tailLen_ < BLOCK) {
+            return;
+        }
+        block(tail_);
+        tailLen_ = 0;
+    }
+
+    while (len >= BLOCK) {
+        block(p);
+        p += BLOCK;
+        len -= BLOCK;
+    }
+
+    memcpy(tail_, p, len);
+    tailLen_ = len;
+}
+
+// Return the hash of everything seen so far. Does not change the state,
+// so more data may be added afterwards.
+//
+uint64_t Hash64::digest() const
+{
+    uint64_t h = total_ * K0;
+    for (int i = 0; i < LANES; i++) {
+        h = rotl(h ^ fmix(lanes_[i]), 27) * K1;
+    }
+
+    for (size_t i = 0; i < tailLen_; i++) {
+        h = rotl(h ^ (tail_[i] * K2), 11) * K0;
+    }
+
+    return fmix(h);
+}
+
+// Mix one full block into the lanes
+//
+void Hash64::block(const uint8_t *p)
+{
+    for (int i = 0; i < LANES; i++) {
+        uint64_t w = load64(p + 8 * i);
+        lanes_[i] = rotl(lanes_[i] + w * K1, 31) * K0;
+    }
+}
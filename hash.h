@@ -0,0 +1,29 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A fast, non-cryptographic streaming 64-bit hash. It's used to key
+// cached decode results on the content of the wave data, so it needs
+// to run at close to memory bandwidth rather than resist attack.
+//
+class Hash64 {
+public:
+    Hash64(uint64_t seed = 0);
+
+    void update(const void *data, size_t len);
+    uint64_t digest() const;
+
+private:
+    static const int LANES = 4;
+
+    uint64_t lanes_[LANES];
+    uint8_t tail_[8 * LANES];
+    size_t tailLen_;
+    uint64_t total_;
+
+    void block(const uint8_t *p);
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "index.h"
+
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::ios;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+// The file format is a header:
+//   4 bytes  magic "OSIX"
+//   1 byte   format version
+// followed by one varint per character: the distance in samples from the
+// start of the character before (or the start of the data, for the
+// first.) A varint is 7 bits per byte, low bits first, with the top bit
+// set on every byte but the last, so at 300 baud most characters take
+// two bytes.
+//
+namespace {
+    const char MAGIC[] = "OSIX";
+    const int VERSION = 1;
+
+    const size_t FLUSH_BYTES = 4096;
+}
+
+IndexWriter::IndexWriter(const string &fname)
+    : last_(0)
+{
+    out_.open(fname, ios::binary|ios::trunc);
+    if (!out_) {
+        throw runtime_error{ "failed to open index file " + fname + "." };
+    }
+
+    buf_.insert(buf_.end(), MAGIC, MAGIC + 4);
+    buf_.push_back(VERSION);
+    flush();
+}
+
+// Add the next character, which starts at `sample'
+void IndexWriter::add(uint64_t sample)
+{
+    // characters come out in order, but don't trust rounding
+    uint64_t delta = sample > last_ ? sample - last_ : 0;
+    last_ += delta;
+
+    while (delta >= 0x80) {
+        buf_.push_back(static_cast<char>((delta & 0x7f) | 0x80));
+        delta >>= 7;
+    }
+    buf_.push_back(static_cast<char>(delta));
+
+    if (buf_.size() >= FLUSH_BYTES) {
+        flush();
+    }
+}
+
+// Write out what's buffered
+void IndexWriter::flush()
+{
+    out_.write(buf_.data(), buf_.size());
+    if (!out_.flush()) {
+        throw runtime_error{ "failed writing index file." };
+    }
+    buf_.clear();
+}
+
+// Read a whole index
+IndexReader::IndexReader(const string &fname)
+{
+    const string badFile = "file is not an osiwave index.";
+
+    std::ifstream in{ fname, ios::binary };
+    if (!in) {
+        throw runtime_error{ "failed to open file." };
+    }
+
+    char header[5];
+    if (!in.read(header, sizeof(header)) || string(header, 4) != MAGIC) {
+        throw runtime_error{ badFile };
+    }
+
+    if (header[4] != VERSION) {
+        throw runtime_error{ "unsupported index version." };
+    }
+
+    vector<char> data{ std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>() };
+
+    uint64_t sample = 0;
+    uint64_t delta = 0;
+    int shift = 0;
+
+    for (char ch : data) {
+        if (shift > 63) {
+            throw runtime_error{ badFile };
+        }
+        delta |= uint64_t(ch & 0x7f) << shift;
+        shift += 7;
+
+        if ((ch & 0x80) == 0) {
+            sample += delta;
+            offsets_.push_back(sample);
+            delta = 0;
+            shift = 0;
+        }
+    }
+
+    if (shift) {
+        throw runtime_error{ "premature end of file on index." };
+    }
+}
+
+uint64_t IndexReader::offset(size_t ch) const
+{
+    if (ch >= offsets_.size()) {
+        throw runtime_error{ "index has only " + std::to_string(offsets_.size()) + " characters." };
+    }
+    return offsets_[ch];
+}
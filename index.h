@@ -0,0 +1,40 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// An index of where each decoded character is in the wave file, as the
+// sample offset of its start bit. Offsets are from the start of the data,
+// whatever -c was, so a later decode of just part of the file can be
+// pointed at a character by its number.
+//
+class IndexWriter {
+public:
+    IndexWriter(const std::string &fname);
+
+    void add(uint64_t sample);
+    void flush();
+
+private:
+    std::ofstream out_;
+    std::vector<char> buf_;
+    uint64_t last_;
+};
+
+class IndexReader {
+public:
+    IndexReader(const std::string &fname);
+
+    size_t size() const { return offsets_.size(); }
+
+    // the sample offset of character `ch'
+    uint64_t offset(size_t ch) const;
+
+private:
+    std::vector<uint64_t> offsets_;
+};
+
+#endif
@@ -0,0 +1,381 @@
+#include "lanes.h"
+
+#include "perfctr.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using std::runtime_error;
+using std::unique_ptr;
+using std::vector;
+
+// One stream's crossings, pulled from the shared front end
+class LaneFrontEnd::Crossings : public CrossingSource {
+public:
+    Crossings(LaneFrontEnd &front, int stream) : front_(front), stream_(stream) {}
+
+    vector<double> getTimestamps(int ncross) override { return front_.getTimestamps(stream_, ncross); }
+
+private:
+    LaneFrontEnd &front_;
+    int stream_;
+};
+
+LaneFrontEnd::LaneFrontEnd(const vector<SampleSource*> &sources, int dcwin, DCFilter::Mode mode, bool negate, int block)
+    : streams_(sources.size())
+    , window_(dcwin)
+    , mode_(mode)
+    , shift_(DCFilter::poleShift(dcwin))
+    , negate_(negate)
+    , block_(block)
+    , rawSamples_(0)
+    , filtered_(0)
+{
+    if (streams_ == 0 || streams_ > LANES) {
+        throw runtime_error{ "lane front end needs 1 to 16 streams." };
+    }
+    if (window_ <= 0) {
+        throw runtime_error{ "invalid DC window." };
+    }
+
+    for (int l = 0; l < LANES; l++) {
+        Lane &lane = lanes_[l];
+        lane.source = l < streams_ ? sources[l] : nullptr;
+        lane.secPerSample = lane.source ? 1.0 / lane.source->getSampleRate() : 0;
+        lane.live = lane.source != nullptr;
+        lane.inRun = false;
+        lane.runStart = 0;
+        lane.samples = 0;
+        lane.next = 0;
+        mask_[l] = lane.live ? 0xff : 0;
+        sum_[l] = 0;
+        dc_[0][l] = dc_[1][l] = 0;
+    }
+
+    for (int i = 0; i < streams_; i++) {
+        outputs_.push_back(unique_ptr<Crossings>{ new Crossings{ *this, i } });
+    }
+
+    if (mode_ == DCFilter::Average) {
+        ring_.resize(window_ * LANES);
+    }
+    raw_.resize(block_ * LANES);
+    flags_.resize(block_ * LANES);
+
+    // two rows of filtered samples are carried from block to block so
+    // each new sample can be checked against the ones before it. They
+    // start out non-zero so they don't look like a run of zeroes.
+    //
+    rows_.assign((block_ + 2) * LANES, 1);
+}
+
+LaneFrontEnd::~LaneFrontEnd()
+{
+}
+
+CrossingSource &LaneFrontEnd::getCrossings(int stream)
+{
+    return *outputs_[stream];
+}
+
+// Return up to `ncross' crossings for one stream
+vector<double> LaneFrontEnd::getTimestamps(int stream, int ncross)
+{
+    Lane &lane = lanes_[stream];
+
+    while (lane.crossings.size() - lane.next < ncross && lane.live) {
+        step();
+    }
+
+    size_t n = std::min<size_t>(ncross, lane.crossings.size() - lane.next);
+    vector<double> out(lane.crossings.begin() + lane.next, lane.crossings.begin() + lane.next + n);
+    lane.next += n;
+
+    if (lane.next > lane.crossings.size() / 2) {
+        lane.crossings.erase(lane.crossings.begin(), lane.crossings.begin() + lane.next);
+        lane.next = 0;
+    }
+
+    return out;
+}
+
+// Read and process one block of samples for every live stream. A stream
+// which comes up short has ended; the block is split where each stream
+// ends so the stream can be finished off before its lane is overrun with
+// padding. Returns false if all the streams have ended.
+//
+bool LaneFrontEnd::step()
+{
+    if (std::none_of(mask_, mask_ + LANES, [](uint8_t live) { return live; })) {
+        return false;
+    }
+
+    PerfScope scope{ PerfCounters::DC };
+    uint32_t got[LANES];
+    vector<uint32_t> ends;
+
+    // Each lane's block is read separately and then interleaved, one
+    // sample of every lane at a time.
+    //
+    vector<int16_t> samples[LANES];
+    for (int l = 0; l < LANES; l++) {
+        if (mask_[l]) {
+            samples[l] = lanes_[l].source->readSamples(block_);
+            if (samples[l].size() < block_) {
+                ends.push_back(samples[l].size());
+            }
+        }
+        got[l] = samples[l].size();
+        samples[l].resize(block_);
+    }
+
+    for (uint32_t i = 0; i < block_; i++) {
+        int16_t *x = &raw_[i * LANES];
+        for (int l = 0; l < LANES; l++) {
+            x[l] = samples[l][i];
+        }
+    }
+
+    std::sort(ends.begin(), ends.end());
+    ends.push_back(block_);
+
+    uint32_t from = 0;
+    for (uint32_t end : ends) {
+        runSegment(from, end);
+        from = end;
+
+        for (int l = 0; l < LANES; l++) {
+            if (mask_[l] && got[l] == end && end < block_) {
+                finish(l);
+            }
+        }
+    }
+
+    return true;
+}
+
+// Filter raw samples [from, to) of the block and look for crossings in
+// the result. Every lane is stepped whether its stream is live or not;
+// the samples of dead lanes are ignored.
+//
+void LaneFrontEnd::runSegment(uint32_t from, uint32_t to)
+{
+    uint32_t nrows;
+
+    {
+        PerfScope scope{ PerfCounters::DC };
+        int16_t *rows = rows_.data() + 2 * LANES;
+        nrows = mode_ == DCFilter::Average ? average(from, to, rows) : highPass(from, to, rows);
+    }
+
+    PerfScope scope{ PerfCounters::ZeroCross };
+
+    // Flag every sample which might end a crossing or a run of zeroes.
+    // The rows are contiguous, so this runs over the whole segment at
+    // once. Few samples are flagged, so the checks themselves can be
+    // done one lane at a time.
+    //
+    const int16_t *p2 = rows_.data();
+    const int16_t *p1 = p2 + LANES;
+    const int16_t *y = p1 + LANES;
+    uint8_t *flags = flags_.data();
+    const uint32_t n = nrows * LANES;
+
+    if (negate_) {
+        for (uint32_t i = 0; i < n; i++) {
+            flags[i] = (p1[i] == 0) | (p2[i] == 0) | ((p1[i] > 0) & (y[i] < 0));
+        }
+    } else {
+        for (uint32_t i = 0; i < n; i++) {
+            flags[i] = (p1[i] == 0) | (p2[i] == 0) | ((p1[i] < 0) & (y[i] > 0));
+        }
+    }
+
+    uint64_t live[LANES / 8];
+    memcpy(live, mask_, sizeof(live));
+
+    for (uint32_t r = 0; r < nrows; r++) {
+        uint64_t words[LANES / 8];
+        memcpy(words, &flags[r * LANES], sizeof(words));
+
+        bool any = false;
+        for (int w = 0; w < LANES / 8; w++) {
+            words[w] &= live[w];
+            any = any || words[w];
+        }
+        if (!any) {
+            continue;
+        }
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(words);
+        for (int l = 0; l < LANES; l++) {
+            if (bytes[l]) {
+                checkPair(l, p1[r * LANES + l], y[r * LANES + l], filtered_ + r);
+            }
+        }
+    }
+
+    filtered_ += nrows;
+    std::copy(rows_.begin() + nrows * LANES, rows_.begin() + (nrows + 2) * LANES, rows_.begin());
+}
+
+// Remove DC from raw samples [from, to) of the block by subtracting a
+// moving average, writing a row of filtered samples to `rows' for each
+// one which comes out. Returns the number of rows.
+//
+uint32_t LaneFrontEnd::average(uint32_t from, uint32_t to, int16_t *rows)
+{
+    const uint32_t window = window_;
+    const uint32_t half = window / 2;
+    uint32_t nrows = 0;
+
+    for (uint32_t i = from; i < to; i++, rawSamples_++) {
+        const int16_t *x = &raw_[i * LANES];
+
+        // filling the window; the first half goes out unfiltered
+        if (rawSamples_ < window) {
+            int16_t *in = &ring_[rawSamples_ * LANES];
+            for (int l = 0; l < LANES; l++) {
+                in[l] = x[l];
+                sum_[l] += x[l];
+            }
+            if (rawSamples_ < half) {
+                std::copy(x, x + LANES, rows + nrows++ * LANES);
+            }
+            continue;
+        }
+
+        // steady state, as in DCFilter. The average is divided in
+        // double precision, which truncates to the same integer as
+        // dividing the sum directly but can be done in vector lanes.
+        //
+        int16_t *in = &ring_[(rawSamples_ % window) * LANES];
+        const int16_t *out = &ring_[((rawSamples_ + half) % window) * LANES];
+        int16_t *y = rows + nrows++ * LANES;
+        const double dwindow = window;
+
+        for (int l = 0; l < LANES; l++) {
+            int32_t avg = static_cast<int32_t>(sum_[l] / dwindow);
+            y[l] = static_cast<int16_t>(out[l] - avg);
+            sum_[l] += x[l] - in[l];
+            in[l] = x[l];
+        }
+    }
+
+    return nrows;
+}
+
+// Remove DC from raw samples [from, to) of the block with the high-pass
+// filter. Every sample comes straight out.
+//
+uint32_t LaneFrontEnd::highPass(uint32_t from, uint32_t to, int16_t *rows)
+{
+    const int shift = shift_;
+    uint32_t nrows = 0;
+
+    for (uint32_t i = from; i < to; i++, rawSamples_++) {
+        const int16_t *x = &raw_[i * LANES];
+        int16_t *y = rows + nrows++ * LANES;
+
+        if (rawSamples_ == 0) {
+            for (int l = 0; l < LANES; l++) {
+                dc_[0][l] = DCFilter::primePole(x[l]);
+            }
+        }
+
+        if (mode_ == DCFilter::TwoPole) {
+            for (int l = 0; l < LANES; l++) {
+                int32_t v = DCFilter::pole(x[l], dc_[0][l], shift);
+                y[l] = DCFilter::clamp(DCFilter::pole(v, dc_[1][l], shift));
+            }
+        } else {
+            for (int l = 0; l < LANES; l++) {
+                y[l] = DCFilter::clamp(DCFilter::pole(x[l], dc_[0][l], shift));
+            }
+        }
+    }
+
+    return nrows;
+}
+
+// The stream in `lane' has ended. Filter what's left in its window with
+// the final average, as DCFilter does at end of file.
+//
+void LaneFrontEnd::finish(int lane)
+{
+    const uint32_t window = window_;
+    const uint32_t half = window / 2;
+    Lane &ln = lanes_[lane];
+
+    int32_t prev = rows_[LANES + lane];
+    uint64_t k = filtered_;
+    auto filtered = [&](int32_t y) {
+        checkPair(lane, prev, y, k++);
+        prev = y;
+    };
+
+    if (mode_ != DCFilter::Average) {
+        // nothing held back
+    } else if (rawSamples_ < window) {
+        // too short to filter
+        for (uint64_t i = half; i < rawSamples_; i++) {
+            filtered(ring_[i * LANES + lane]);
+        }
+    } else {
+        // (a window of one leaves nothing behind)
+        int32_t avg = sum_[lane] / window_;
+        for (uint64_t i = rawSamples_ - (window - half) % window; i < rawSamples_; i++) {
+            filtered(static_cast<int16_t>(ring_[(i % window) * LANES + lane] - avg));
+        }
+    }
+
+    // a run of zeroes at the very end still counts
+    if (ln.inRun) {
+        ln.crossings.push_back(ln.secPerSample * (ln.runStart + (k - ln.runStart) * 0.5));
+        ln.inRun = false;
+    }
+
+    ln.samples = rawSamples_;
+    ln.live = false;
+    mask_[lane] = 0;
+}
+
+// Check the pair of filtered samples `l' and `r' of a stream for a 
+// crossing, where `r' is sample `k' of the stream. This follows 
+// ZeroCrossFilter exactly, including where it puts the crossing in
+// a run of zeroes.
+//
+void LaneFrontEnd::checkPair(int lane, int l, int r, uint64_t k)
+{
+    Lane &ln = lanes_[lane];
+
+    if (k == 0) {
+        return;
+    }
+
+    if (l == 0) {
+        if (!ln.inRun) {
+            ln.inRun = true;
+            ln.runStart = k - 1;
+        }
+        return;
+    }
+
+    if (ln.inRun) {
+        ln.crossings.push_back(ln.secPerSample * (ln.runStart + (k - 1 - ln.runStart) * 0.5));
+        ln.inRun = false;
+    }
+
+    double t;
+    if (negate_ && l > 0 && r < 0) {
+        t = double(l) / double(l - r);
+    } else if (!negate_ && l < 0 && r > 0) {
+        t = double(-l) / double(r - l);
+    } else {
+        return;
+    }
+
+    ln.crossings.push_back((k + t) * ln.secPerSample);
+}
@@ -0,0 +1,75 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "dcfilter.h"
+#include "stage.h"
+
+// Removes DC and finds zero crossings for up to LANES streams at once.
+// The state of the streams is kept as arrays indexed by lane, one stream
+// per lane, so the inner loops step every stream through the same sample
+// together and the compiler can turn them into vector instructions. The
+// output is the same as a DCFilter and ZeroCrossFilter per stream.
+//
+// Each stream's crossings are pulled through getCrossings(); whenever a
+// stream runs dry, another block is processed for all of them.
+//
+class LaneFrontEnd {
+public:
+    static const int LANES = 16;
+
+    LaneFrontEnd(const std::vector<SampleSource*> &sources, int dcwin, DCFilter::Mode mode, bool negate, int block = 4096);
+    ~LaneFrontEnd();
+
+    int getStreams() const { return streams_; }
+    CrossingSource &getCrossings(int stream);
+    uint64_t getSampleCount(int stream) const { return lanes_[stream].samples; }
+
+private:
+    class Crossings;
+
+    struct Lane {
+        SampleSource *source;
+        double secPerSample;
+        bool live;
+        bool inRun;
+        uint64_t runStart;
+        uint64_t samples;
+        std::vector<double> crossings;
+        size_t next;
+    };
+
+    int streams_;
+    int window_;
+    DCFilter::Mode mode_;
+    int shift_;
+    bool negate_;
+    uint32_t block_;
+    Lane lanes_[LANES];
+    std::vector<std::unique_ptr<Crossings>> outputs_;
+
+    // sample state, all indexed [sample * LANES + lane]
+    std::vector<int16_t> ring_;
+    std::vector<int16_t> raw_;
+    std::vector<int16_t> rows_;
+    std::vector<uint8_t> flags_;
+    int32_t sum_[LANES];
+    int32_t dc_[2][LANES];
+    uint8_t mask_[LANES];
+
+    uint64_t rawSamples_;
+    uint64_t filtered_;
+
+    std::vector<double> getTimestamps(int stream, int ncross);
+    bool step();
+    void runSegment(uint32_t from, uint32_t to);
+    uint32_t average(uint32_t from, uint32_t to, int16_t *rows);
+    uint32_t highPass(uint32_t from, uint32_t to, int16_t *rows);
+    void finish(int lane);
+    void checkPair(int lane, int l, int r, uint64_t k);
+};
+
+#endif
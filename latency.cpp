@@ -0,0 +1,53 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::vector;
+
+LatencyMeter::LatencyMeter(int sampleRate)
+    : sampleRate_(sampleRate)
+{
+}
+
+// Note that all samples before `endSample' have now been read from the 
+// input.
+//
+void LatencyMeter::samplesArrived(uint64_t endSample)
+{
+    arrivals_.push_back({ endSample, Clock::now() });
+}
+
+// Note that a character whose stop bit starts at `time' seconds into
+// the stream has been decoded.
+//
+void LatencyMeter::charDecoded(double time)
+{
+    uint64_t sample = static_cast<uint64_t>(time * sampleRate_);
+
+    // characters come out in order, so arrivals before this one will
+    // never be needed again
+    while (arrivals_.size() > 1 && arrivals_.front().first <= sample) {
+        arrivals_.pop_front();
+    }
+
+    if (arrivals_.empty()) {
+        return;
+    }
+
+    std::chrono::duration<double> latency = Clock::now() - arrivals_.front().second;
+    latencies_.push_back(latency.count());
+}
+
+// Return the given percentile of the latencies seen so far, in seconds
+//
+double LatencyMeter::getPercentile(double pct)
+{
+    if (latencies_.empty()) {
+        return 0.0;
+    }
+
+    size_t n = std::min(latencies_.size() - 1, static_cast<size_t>(std::ceil(pct / 100.0 * latencies_.size())) - 1);
+    std::nth_element(latencies_.begin(), latencies_.begin() + n, latencies_.end());
+    return latencies_[n];
+}
@@ -0,0 +1,31 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+// Measures how long it takes from a sample arriving from the input to
+// the character it completes being decoded. 
+//
+class LatencyMeter {
+public:
+    LatencyMeter(int sampleRate);
+
+    void samplesArrived(uint64_t endSample);
+    void charDecoded(double time);
+
+    size_t getCount() const { return latencies_.size(); }
+    double getPercentile(double pct);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    int sampleRate_;
+    std::deque<std::pair<uint64_t, Clock::time_point>> arrivals_;
+    std::vector<double> latencies_;
+};
+
+#endif
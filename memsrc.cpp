@@ -0,0 +1,28 @@
+#include "memsrc.h"
+
+#include <algorithm>
+#include <vector>
+
+using std::vector;
+
+MemorySource::MemorySource(vector<int16_t> samples, int sampleRate)
+    : samples_(std::move(samples))
+    , sampleRate_(sampleRate)
+    , pos_(0)
+{
+}
+
+// Skip over some samples
+void MemorySource::skip(uint32_t nsamples)
+{
+    pos_ = std::min(samples_.size(), pos_ + nsamples);
+}
+
+// Return the next `nsamples' samples, or fewer at the end
+vector<int16_t> MemorySource::readSamples(uint32_t nsamples)
+{
+    size_t n = std::min<size_t>(nsamples, samples_.size() - pos_);
+    vector<int16_t> out(samples_.begin() + pos_, samples_.begin() + pos_ + n);
+    pos_ += n;
+    return out;
+}
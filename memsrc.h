@@ -0,0 +1,26 @@
+#ifndef MEMSRC_H
+#define MEMSRC_H
+
+#include <cstdint>
+#include <vector>
+
+#include "stage.h"
+
+// Samples which are already in memory, e.g. sent to the daemon over a 
+// socket.
+//
+class MemorySource : public SampleSource {
+public:
+    MemorySource(std::vector<int16_t> samples, int sampleRate);
+
+    int getSampleRate() const override { return sampleRate_; }
+    void skip(uint32_t nsamples) override;
+    std::vector<int16_t> readSamples(uint32_t nsamples) override;
+
+private:
+    std::vector<int16_t> samples_;
+    int sampleRate_;
+    size_t pos_;
+};
+
+#endif
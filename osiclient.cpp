@@ -0,0 +1,164 @@
+#include "audio.h"
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+// Print usage and exit
+void usage() 
+{
+    cerr << "osiclient: [-s] [-x] [-o \"option=value ...\"] socket wave-file..." << endl;
+    exit(1);
+}
+
+namespace {
+    // Connect to the daemon listening on `path'
+    int connectTo(const string &path)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw runtime_error{ "socket path too long." };
+        }
+        strcpy(addr.sun_path, path.c_str());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+            string err = strerror(errno);
+            if (fd != -1) {
+                close(fd);
+            }
+            throw runtime_error{ "cannot connect to daemon: " + err + "." };
+        }
+
+        return fd;
+    }
+
+    void writeAll(int fd, const char *data, size_t nbytes)
+    {
+        while (nbytes) {
+            ssize_t n = send(fd, data, nbytes, MSG_NOSIGNAL);
+            if (n <= 0) {
+                throw runtime_error{ "lost connection to daemon." };
+            }
+            data += n;
+            nbytes -= n;
+        }
+    }
+}
+
+// Send wave files to a daemon started with `osiwave -D socket' to be
+// decoded. Normally the daemon is given the path of each file to read
+// itself; with -x, the client reads the file and sends the samples.
+//
+int main(int argc, char **argv)
+{
+    bool stats = false;
+    bool sendSamples = false;
+    string options;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:sx")) != -1) {
+        switch (opt) {
+        case 'o':
+            options = optarg;
+            break;
+
+        case 's':
+            stats = true;
+            break;
+
+        case 'x':
+            sendSamples = true;
+            break;
+
+        default:
+            usage();
+        }
+    }
+
+    if (optind > argc - 2) {
+        usage();
+    }
+
+    string socketPath = argv[optind];
+    int status = 0;
+
+    for (int i = optind + 1; i < argc; i++) {
+        string waveFile = argv[i];
+
+        try {
+            int fd = connectTo(socketPath);
+
+            string request;
+            vector<char> data;
+
+            if (sendSamples) {
+                auto reader = AudioReader::open(waveFile);
+                vector<int16_t> samples;
+                while (true) {
+                    vector<int16_t> block = reader->readSamples(65536);
+                    if (block.size() == 0) {
+                        break;
+                    }
+                    samples.insert(samples.end(), block.begin(), block.end());
+                }
+
+                for (int16_t s : samples) {
+                    data.push_back(char(s & 0xff));
+                    data.push_back(char((s >> 8) & 0xff));
+                }
+                request = "SAMPLES " + options + " -- " + std::to_string(samples.size()) + "\n";
+            } else {
+                char path[PATH_MAX];
+                if (realpath(waveFile.c_str(), path) == nullptr) {
+                    throw runtime_error{ string{ strerror(errno) } + "." };
+                }
+                request = "DECODE " + options + " -- " + path + "\n";
+            }
+
+            writeAll(fd, request.data(), request.size());
+            writeAll(fd, data.data(), data.size());
+
+            string reply;
+            char buf[4096];
+            ssize_t n;
+            while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                reply.append(buf, n);
+            }
+            close(fd);
+
+            size_t eol = reply.find('\n');
+            if (reply.compare(0, 3, "OK ") != 0 || eol == string::npos) {
+                throw runtime_error{ reply.compare(0, 6, "ERROR ") == 0 ? reply.substr(6, eol - 6) : "bad reply from daemon." };
+            }
+
+            size_t length = strtoul(reply.c_str() + 3, nullptr, 10);
+            cout << reply.substr(eol + 1, length) << endl;
+            if (stats) {
+                cerr << reply.substr(eol + 1 + length);
+            }
+        } catch (runtime_error re) {
+            cerr << waveFile << ": " << re.what() << endl;
+            status = 1;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,134 @@
+#include "tracer.h"
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::runtime_error;
+using std::string;
+
+// Print usage and exit
+void usage() 
+{
+    cerr << "ositrace: [-c] [-t classes] trace-file" << endl;
+    exit(1);
+}
+
+namespace {
+    const char *typeName(int type)
+    {
+        switch (type) {
+        case TraceEvent::Crossing: return "cross";
+        case TraceEvent::SpanChange: return "span";
+        case TraceEvent::Bit: return "bit";
+        case TraceEvent::FrameAccept: return "accept";
+        case TraceEvent::FrameReject: return "reject";
+        }
+        return "unknown";
+    }
+
+    const char *valueName(int value)
+    {
+        switch (value) {
+        case 0: return "space";
+        case 1: return "mark";
+        case 2: return "noise";
+        }
+        return "unknown";
+    }
+}
+
+// Convert a binary trace written by osiwave -T to text, one event per
+// line, in the order the stages wrote them out. Each event is given with
+// its sample offset in the wave file and its time in seconds.
+//
+int main(int argc, char **argv)
+{
+    bool csv = false;
+    string classes;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ct:")) != -1) {
+        switch (opt) {
+        case 'c':
+            csv = true;
+            break;
+
+        case 't':
+            classes = optarg;
+            break;
+
+        default:
+            usage();
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage();
+    }
+
+    string traceFile = argv[optind];
+
+    try {
+        TraceReader reader{ traceFile };
+        double rate = reader.getSampleRate();
+        uint64_t startSample = reader.getStartSample();
+
+        if (csv) {
+            cout << "stage,event,sample,time,value,from,to" << endl;
+        }
+
+        TraceEvent ev;
+        while (reader.next(ev)) {
+            if (!classes.empty() && classes.find(char(ev.stage)) == string::npos) {
+                continue;
+            }
+
+            uint64_t sample = startSample + uint64_t(ev.time * rate + 0.5);
+
+            if (csv) {
+                cout 
+                    << ev.stage << "," << typeName(ev.type) << "," << sample << "," << ev.time << "," 
+                    << ev.value << "," << int(ev.from) << "," << int(ev.to) << endl;
+                continue;
+            }
+
+            cout << ev.stage << " " << sample << " " << ev.time << " " << typeName(ev.type);
+            switch (ev.type) {
+            case TraceEvent::Crossing:
+                if (ev.value) {
+                    cout << " (zeroes)";
+                }
+                break;
+
+            case TraceEvent::SpanChange:
+                cout << " " << ev.value << "Hz " << valueName(ev.from) << " -> " << valueName(ev.to);
+                break;
+
+            case TraceEvent::Bit:
+                cout << " " << ev.value;
+                break;
+
+            case TraceEvent::FrameAccept:
+            case TraceEvent::FrameReject:
+                cout << " " << int(ev.value);
+                if (ev.value >= 0x20 && ev.value <= 0x7e) {
+                    cout << " '" << char(ev.value) << "'";
+                }
+                break;
+            }
+            cout << endl;
+        }
+    } catch (runtime_error re) {
+        cerr << traceFile << ": " << re.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
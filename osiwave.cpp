@@ -1,26 +1,57 @@
-#include "wave.h"
+#include "audio.h"
+#include "bandtrk.h"
+#include "baud.h"
+#include "cache.h"
+#include "consensus.h"
+#include "daemon.h"
 #include "dcfilter.h"
+#include "decoder.h"
 #include "xcross.h"
 #include "freqspan.h"
+#include "fused.h"
 #include "denoise.h"
 #include "bitstrm.h"
 #include "frameflt.h"
+#include "index.h"
+#include "lanes.h"
+#include "dump.h"
+#include "latency.h"
+#include "perfctr.h"
+#include "quality.h"
+#include "redecode.h"
+#include "region.h"
+#include "tracer.h"
+#include "triage.h"
+#include "tune.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <map>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 
 #include <unistd.h>
 
 using std::cerr;
 using std::cout;
 using std::endl;
+using std::flush;
+using std::map;
+using std::ofstream;
 using std::runtime_error;
 using std::set;
 using std::string;
+using std::stringstream;
+using std::thread;
 using std::unique_ptr;
 using std::vector;
 
@@ -29,20 +60,498 @@ using Span = FreqSpanFilter::Span;
 // Print usage and exit
 void usage() 
 {
-    cerr << "osiwave: [-c clip-samples] [-d dc-window-size] [-n] wave-file" << endl;
+    cerr << "osiwave: [-c clip-samples] [-d dc-window-size] [-I poles] [-n] [-a] [-p] [-B baud|auto] [-q seconds[:skip]]" << endl;
+    cerr << "         [-r read-ahead] [-s]" << endl;
+    cerr << "         [-f] [-P] [-b stage=size,...] [-l] [-C cache-dir[:megabytes]] [-t classes] [-T trace-file]" << endl;
+    cerr << "         [-w stage:dump-file] [-X index-file] [-R first:last] [-k confidence-file] [-K] wave-file" << endl;
+    cerr << "         [-t classes] [-T trace-file] [-w stage:dump-file] -i dump-file" << endl;
+    cerr << "         -m [-L] [-g agreement-file] wave-file wave-file..." << endl;
+    cerr << "         -L wave-file..." << endl;
+    cerr << "         -V wave-file" << endl;
+    cerr << "         -Q [-d dc-window-size] [-I poles] [-n] [-r read-ahead] [-s] wave-file..." << endl;
+    cerr << "         -A [-c clip-samples] [-f] [-a] [-p] [-B baud|auto] [-b stage=size,...] [wave-file]" << endl;
+    cerr << "         -D socket [-j workers]" << endl;
     exit(1);
 }
 
+// Decode several streams at once: each file given with -m, or with -L
+// each channel of each file. With `lanes', DC removal and crossing 
+// detection are run for up to 16 streams at a time in vector lanes, and
+// the rest of each decode is stepped in turn on this thread. Otherwise
+// each stream is decoded in its own thread. With `consensus', what most
+// of the streams agree on is printed, and otherwise each decode is 
+// printed under its name.
+//
+int decodeMany(const vector<string> &files, const DecodeOptions &opts, int readAhead, bool lanes, bool consensusVote, const string &agreementFile, bool stats, bool perfCounters)
+{
+    vector<unique_ptr<AudioReader>> readers;
+    vector<string> names;
+    vector<unique_ptr<LaneFrontEnd>> frontEnds;
+    vector<unique_ptr<Decoder>> decoders;
+
+    for (auto &file : files) {
+        try {
+            readers.push_back(AudioReader::open(file));
+            if (readers.back()->getSampleRate() != 44100) {
+                cerr << file << ": file must be 44kHz" << endl;
+                return 1;
+            }
+            names.push_back(file);
+
+            int channels = lanes ? readers.back()->getChannels() : 1;
+            for (int chan = 1; chan < channels; chan++) {
+                readers.push_back(AudioReader::open(file));
+                readers.back()->setReadChannel(chan);
+                names.push_back(file + ":" + std::to_string(chan));
+            }
+            if (channels > 1) {
+                names[names.size() - channels] += ":0";
+            }
+        } catch (runtime_error re) {
+            cerr << file << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    try {
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (readAhead) {
+                readers[i]->startReadAhead(readAhead);
+            }
+
+            if (!lanes) {
+                decoders.push_back(unique_ptr<Decoder>{ new Decoder{ *readers[i], opts } });
+                continue;
+            }
+
+            if (opts.clip) {
+                readers[i]->skip(opts.clip);
+            }
+
+            if (i % LaneFrontEnd::LANES == 0) {
+                size_t n = std::min<size_t>(LaneFrontEnd::LANES, readers.size() - i);
+                vector<SampleSource*> sources;
+                for (size_t j = i; j < i + n; j++) {
+                    sources.push_back(readers[j].get());
+                }
+                frontEnds.push_back(unique_ptr<LaneFrontEnd>{ new LaneFrontEnd{ sources, opts.dcwin, opts.dcMode(), opts.negate, opts.blocks.at('z') } });
+            }
+
+            CrossingSource &crossings = frontEnds.back()->getCrossings(i % LaneFrontEnd::LANES);
+            decoders.push_back(unique_ptr<Decoder>{ new Decoder{ crossings, opts } });
+        }
+    } catch (runtime_error re) {
+        cerr << re.what() << endl;
+        return 1;
+    }
+
+    unique_ptr<PerfCounters> perf;
+    if (perfCounters) {
+        try {
+            perf = unique_ptr<PerfCounters>{ new PerfCounters{} };
+        } catch (runtime_error re) {
+            cerr << re.what() << endl;
+            return 1;
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    vector<string> errors(decoders.size());
+
+    if (lanes) {
+        // the streams sharing a front end are kept roughly in step, so 
+        // it doesn't have to hold much for any of them
+        vector<bool> done(decoders.size());
+        bool more = true;
+
+        while (more) {
+            more = false;
+            for (size_t i = 0; i < decoders.size(); i++) {
+                if (done[i]) {
+                    continue;
+                }
+                try {
+                    done[i] = !decoders[i]->step();
+                } catch (runtime_error re) {
+                    errors[i] = re.what();
+                    done[i] = true;
+                }
+                more = more || !done[i];
+            }
+        }
+    } else {
+        vector<thread> threads;
+        for (size_t i = 0; i < decoders.size(); i++) {
+            threads.emplace_back([&decoders, &errors, i]() {
+                try {
+                    decoders[i]->run();
+                } catch (runtime_error re) {
+                    errors[i] = re.what();
+                }
+            });
+        }
+
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+
+    for (size_t i = 0; i < decoders.size(); i++) {
+        if (!errors[i].empty()) {
+            cerr << names[i] << ": " << errors[i] << endl;
+            return 1;
+        }
+    }
+
+    unique_ptr<Consensus> consensus;
+
+    if (consensusVote) {
+        vector<Consensus::Capture> captures;
+        for (auto &decoder : decoders) {
+            Consensus::Capture capture;
+            capture.chars = decoder->getChars();
+            for (auto &pos : decoder->getPositions()) {
+                capture.times.push_back(pos.start);
+            }
+            captures.push_back(capture);
+        }
+
+        consensus = unique_ptr<Consensus>{ new Consensus{ captures } };
+        consensus->run();
+
+        cout << consensus->getChars() << endl;
+    } else {
+        for (size_t i = 0; i < decoders.size(); i++) {
+            cout << "==> " << names[i] << " <==" << endl << decoders[i]->getChars() << endl;
+        }
+    }
+
+    // one line per character: time in the reference capture, how many
+    // captures agreed, and the character code in hex
+    if (consensus && !agreementFile.empty()) {
+        ofstream out{ agreementFile };
+        if (!out) {
+            cerr << agreementFile << ": failed to open file." << endl;
+            return 1;
+        }
+
+        auto &chars = consensus->getChars();
+        for (size_t i = 0; i < chars.size(); i++) {
+            out 
+                << consensus->getTimes()[i] << " " 
+                << consensus->getAgreement()[i] << "/" << decoders.size() << " "
+                << std::hex << int(static_cast<uint8_t>(chars[i])) << std::dec << endl;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    if (stats) {
+        for (size_t i = 0; i < decoders.size(); i++) {
+            bool reference = consensus && int(i) == consensus->getReference();
+            cerr << (consensus ? "capture " : "stream ") << names[i] << (reference ? " (reference)" : "") << endl;
+            if (lanes) {
+                auto &frontEnd = frontEnds[i / LaneFrontEnd::LANES];
+                cerr << "samples " << frontEnd->getSampleCount(i % LaneFrontEnd::LANES) << endl;
+            }
+            cerr 
+                << decoders[i]->getStats()
+                << "io-wait-seconds " << readers[i]->getIoWaitSeconds() << endl;
+            if (consensus && !reference) {
+                cerr 
+                    << "alignment-cost " << consensus->getCost(i) << endl
+                    << "voting " << consensus->isVoting(i) << endl;
+            }
+        }
+
+        if (consensus) {
+            auto &agreement = consensus->getAgreement();
+            cerr 
+                << "consensus-chars " << agreement.size() << endl
+                << "consensus-unanimous " << std::count(agreement.begin(), agreement.end(), int(decoders.size())) << endl;
+        }
+        cerr << "decode-seconds " << elapsed.count() << endl;
+    }
+
+    if (perf) {
+        perf->report(cerr);
+    }
+
+    return 0;
+}
+
+// Run the fused front end and the separate DC, crossing and span stages
+// it replaces side by side over the same file, and check that they make
+// exactly the same spans.
+//
+int verifyFused(const string &file, const DecodeOptions &opts)
+{
+    unique_ptr<AudioReader> refReader;
+    unique_ptr<AudioReader> fusedReader;
+
+    try {
+        refReader = AudioReader::open(file);
+        fusedReader = AudioReader::open(file);
+        if (refReader->getSampleRate() != 44100) {
+            cerr << file << ": file must be 44kHz" << endl;
+            return 1;
+        }
+    } catch (runtime_error re) {
+        cerr << file << ": " << re.what() << endl;
+        return 1;
+    }
+
+    if (opts.clip) {
+        refReader->skip(opts.clip);
+        fusedReader->skip(opts.clip);
+    }
+
+    DCFilter dcFilter{ *refReader, opts.dcwin, opts.dcMode() };
+    ZeroCrossFilter zeroCross{ dcFilter, refReader->getSampleRate(), opts.negate, opts.blocks.at('z') };
+    FreqSpanFilter freqSpan{ zeroCross, opts.blocks.at('f') };
+    FusedFrontEnd fused{ *fusedReader, opts.dcwin, opts.dcMode(), opts.negate, opts.blocks.at('z') };
+    if (opts.adaptive) {
+        freqSpan.adapt();
+        fused.adapt();
+    }
+
+    auto print = [](const Span &span) {
+        stringstream ss;
+        ss.precision(17);
+        ss << SpanSource::valueName(span.value) << " start " << span.start << " length " << span.length << " clock " << span.clock << " edge " << span.evidence.edge;
+        return ss.str();
+    };
+
+    uint64_t nspans = 0;
+    vector<Span> ref;
+    vector<Span> fast;
+    size_t refIdx = 0;
+    size_t fastIdx = 0;
+
+    while (true) {
+        if (refIdx == ref.size()) {
+            ref = freqSpan.getSpans(opts.blocks.at('n'));
+            refIdx = 0;
+        }
+        if (fastIdx == fast.size()) {
+            fast = fused.getSpans(opts.blocks.at('n'));
+            fastIdx = 0;
+        }
+
+        bool refEnd = refIdx == ref.size();
+        bool fastEnd = fastIdx == fast.size();
+        if (refEnd || fastEnd) {
+            if (refEnd != fastEnd) {
+                cout << file << ": span " << nspans << ": " << (refEnd ? "reference" : "fused front end") << " ended first" << endl;
+                return 1;
+            }
+            break;
+        }
+
+        const Span &a = ref[refIdx++];
+        const Span &b = fast[fastIdx++];
+        if (a.value != b.value || a.start != b.start || a.length != b.length || a.clocks != b.clocks || a.clock != b.clock || a.evidence.edge != b.evidence.edge) {
+            cout 
+                << file << ": span " << nspans << " differs" << endl
+                << "  reference " << print(a) << endl
+                << "  fused     " << print(b) << endl;
+            return 1;
+        }
+        nspans++;
+    }
+
+    cout << file << ": " << nspans << " spans, " << dcFilter.getSampleCount() << " samples, fused front end matches" << endl;
+    return 0;
+}
+
+// Parse one end of a region given with -R: a sample offset, or `#n' for
+// the start of character n in the index
+uint64_t regionEnd(const string &arg, const IndexReader *index)
+{
+    if (arg.empty() || (arg[0] == '#' && arg.size() == 1)) {
+        throw runtime_error{ "invalid region." };
+    }
+
+    if (arg[0] != '#') {
+        return strtoull(arg.c_str(), nullptr, 10);
+    }
+
+    if (index == nullptr) {
+        throw runtime_error{ "-X must give the index to find characters by number." };
+    }
+    return index->offset(strtoull(arg.c_str() + 1, nullptr, 10));
+}
+
+// Report on each of the given files without decoding them, with the name
+// of each before its report if there's more than one.
+//
+int triageMany(const vector<string> &files, const DecodeOptions &opts, int readAhead, bool stats)
+{
+    for (auto &file : files) {
+        unique_ptr<AudioReader> reader;
+
+        try {
+            reader = AudioReader::open(file);
+            if (reader->getSampleRate() != 44100) {
+                cerr << file << ": file must be 44kHz" << endl;
+                return 1;
+            }
+            if (readAhead) {
+                reader->startReadAhead(readAhead);
+            }
+
+            auto startTime = std::chrono::steady_clock::now();
+
+            TriageReport triage{ *reader, opts.dcwin, opts.dcMode(), opts.negate, opts.blocks.at('z') };
+            triage.run();
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+            if (files.size() > 1) {
+                cout << "==> " << file << " <==" << endl;
+            }
+            triage.report(cout);
+
+            if (stats) {
+                double seconds = double(triage.getSampleCount()) / reader->getSampleRate();
+                cerr
+                    << "samples " << triage.getSampleCount() << endl
+                    << "triage-seconds " << elapsed.count() << endl
+                    << "times-real-time " << seconds / std::max(elapsed.count(), 1e-9) << endl
+                    << "io-wait-seconds " << reader->getIoWaitSeconds() << endl;
+            }
+        } catch (runtime_error re) {
+            cerr << file << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Find the block sizes the chain runs fastest with on this machine, by
+// decoding a clip (the start of `file', or a made up tape if it's empty)
+// with each, and save them for later runs.
+//
+int tuneBlocks(const string &file, const DecodeOptions &opts)
+{
+    const int RATE = 44100;
+    const double SECONDS = 30;
+
+    vector<int16_t> samples;
+    if (file.empty()) {
+        samples = BlockTuner::synthesize(RATE, SECONDS, opts);
+    } else {
+        try {
+            auto reader = AudioReader::open(file);
+            if (reader->getSampleRate() != RATE) {
+                cerr << file << ": file must be 44kHz" << endl;
+                return 1;
+            }
+            if (opts.clip) {
+                reader->skip(opts.clip);
+            }
+            while (samples.size() < SECONDS * RATE) {
+                vector<int16_t> block = reader->readSamples(65536);
+                if (block.empty()) {
+                    break;
+                }
+                samples.insert(samples.end(), block.begin(), block.end());
+            }
+        } catch (runtime_error re) {
+            cerr << file << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    string config = BlockTuner::configPath();
+    if (config.empty()) {
+        cerr << "no home directory to keep the block sizes in; set OSIWAVE_CONFIG." << endl;
+        return 1;
+    }
+
+    BlockTuner tuner{ std::move(samples), RATE, opts };
+    tuner.run(cout);
+
+    cout << "blocks";
+    char sep = ' ';
+    for (auto &block : tuner.getBlocks()) {
+        cout << sep << block.first << "=" << block.second;
+        sep = ',';
+    }
+    cout << endl
+        << "default-seconds " << tuner.getDefaultSeconds() << endl
+        << "tuned-seconds " << tuner.getTunedSeconds() << endl;
+
+    try {
+        BlockTuner::save(config, tuner.getBlocks());
+    } catch (runtime_error re) {
+        cerr << config << ": " << re.what() << endl;
+        return 1;
+    }
+
+    cout << "saved to " << config << endl;
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     int clip = 0;
     int dcwin = 96;
+    int poles = 0;
+    int baud = BandTracker::BAUD_RATE;
     int opt;
     set<char> trace;
     bool negateZeroCross = false;
+    bool adaptive = false;
+    bool recoverClock = false;
+    int readAhead = 0;
+    bool stats = false;
+    string cacheDir;
+    uint64_t cacheMegabytes = 256;
+    map<char, string> dumps;
+    string resumeFile;
+    bool lowLatency = false;
+    map<char, int> blockSizes;
+    string traceFile = "osiwave.trace";
+    bool perfCounters = false;
+    bool multi = false;
+    bool lanes = false;
+    bool fusedFront = false;
+    bool verify = false;
+    bool triage = false;
+    bool tune = false;
+    double quality = 0;
+    bool qualitySkip = false;
+    string daemonSocket;
+    int workers = std::max(1u, thread::hardware_concurrency());
+    string agreementFile;
+    string indexFile;
+    string region;
+    string confidenceFile;
+    bool secondPass = false;
 
-    while ((opt = getopt(argc, argv, "c:d:nt:")) != -1) {
+    while ((opt = getopt(argc, argv, "ab:c:d:fg:i:j:k:lmnpq:r:st:w:AB:C:D:I:KLPQR:T:VX:")) != -1) {
         switch (opt) {
+        case 'a':
+            adaptive = true;
+            break;
+
+        case 'b':
+            // stage=size[,stage=size...]
+            for (char *pch = optarg; *pch; ) {
+                if (pch[0] == '\0' || pch[1] != '=') {
+                    usage();
+                }
+                blockSizes[pch[0]] = atoi(pch + 2);
+                pch = strchr(pch, ',');
+                if (pch == nullptr) {
+                    break;
+                }
+                pch++;
+            }
+            break;
+
         case 'c':
             clip = atoi(optarg);
             break;
@@ -51,22 +560,216 @@ int main(int argc, char **argv)
             dcwin = atoi(optarg);
             break;
 
+        case 'f':
+            fusedFront = true;
+            break;
+
+        case 'g':
+            agreementFile = optarg;
+            break;
+
+        case 'i':
+            resumeFile = optarg;
+            break;
+
+        case 'j':
+            workers = atoi(optarg);
+            break;
+
+        case 'k':
+            confidenceFile = optarg;
+            break;
+
+        case 'l':
+            lowLatency = true;
+            break;
+
+        case 'm':
+            multi = true;
+            break;
+
         case 'n':
             negateZeroCross = true;
             break;
 
+        case 'p':
+            recoverClock = true;
+            break;
+
+        case 'q':
+            // seconds[:skip]
+            quality = atof(optarg);
+            qualitySkip = strcmp(optarg + strcspn(optarg, ":"), ":skip") == 0;
+            if (quality <= 0 || (strchr(optarg, ':') && !qualitySkip)) {
+                usage();
+            }
+            break;
+
+        case 'r':
+            readAhead = atoi(optarg);
+            break;
+
+        case 's':
+            stats = true;
+            break;
+
         case 't':
             for (char *pch = optarg; *pch; pch++) {
                 trace.insert(*pch);
             }
             break;
+
+        case 'w':
+            if (optarg[0] == '\0' || optarg[1] != ':') {
+                usage();
+            }
+            dumps[optarg[0]] = optarg + 2;
+            break;
+
+        case 'A':
+            tune = true;
+            break;
+
+        case 'B':
+            baud = strcmp(optarg, "auto") == 0 ? BaudFilter::AUTO : atoi(optarg);
+            if (baud != BaudFilter::AUTO && baud != 300 && baud != 600 && baud != 1200) {
+                usage();
+            }
+            break;
+
+        case 'C':
+            cacheDir = optarg;
+            if (cacheDir.find(':') != string::npos) {
+                cacheMegabytes = atoi(cacheDir.substr(cacheDir.find(':') + 1).c_str());
+                cacheDir = cacheDir.substr(0, cacheDir.find(':'));
+            }
+            break;
+
+        case 'D':
+            daemonSocket = optarg;
+            break;
+
+        case 'I':
+            poles = atoi(optarg);
+            if (poles < 1 || poles > 2) {
+                usage();
+            }
+            break;
+
+        case 'K':
+            secondPass = true;
+            break;
+
+        case 'L':
+            lanes = true;
+            break;
+
+        case 'P':
+            perfCounters = true;
+            break;
+
+        case 'Q':
+            triage = true;
+            break;
+
+        case 'R':
+            region = optarg;
+            if (region.find(':') == string::npos) {
+                usage();
+            }
+            break;
+
+        case 'T':
+            traceFile = optarg;
+            break;
+
+        case 'V':
+            verify = true;
+            break;
+
+        case 'X':
+            indexFile = optarg;
+            break;
         
         default:
             usage();
         }
     } 
 
-    if (optind != argc-1) {
+    if ((!indexFile.empty() || !region.empty()) && (!daemonSocket.empty() || verify || multi || lanes || !resumeFile.empty())) {
+        cerr << "-X and -R can't be used with -D, -V, -m, -L or -i." << endl;
+        return 1;
+    }
+    if (!region.empty() && clip) {
+        cerr << "-c can't be used with -R." << endl;
+        return 1;
+    }
+    if (quality && (verify || triage || !resumeFile.empty())) {
+        cerr << "-q can't be used with -V, -Q or -i." << endl;
+        return 1;
+    }
+    if (qualitySkip && (lanes || !trace.empty())) {
+        cerr << "-q ...:skip can't be used with -L or -t." << endl;
+        return 1;
+    }
+    if ((!confidenceFile.empty() || secondPass) && (!daemonSocket.empty() || verify || triage || tune || multi || lanes || !resumeFile.empty())) {
+        cerr << "-k and -K can't be used with -D, -V, -Q, -A, -m, -L or -i." << endl;
+        return 1;
+    }
+    if (secondPass && (lowLatency || !region.empty())) {
+        cerr << "-K can't be used with -l or -R." << endl;
+        return 1;
+    }
+
+    if (tune) {
+        if (optind < argc - 1 || multi || lanes || verify || triage || !daemonSocket.empty() || !resumeFile.empty() || !agreementFile.empty()) {
+            usage();
+        }
+        if (!trace.empty() || !dumps.empty() || lowLatency || !cacheDir.empty() || perfCounters || !indexFile.empty() || !region.empty() || quality) {
+            cerr << "-t, -w, -l, -C, -P, -X, -R and -q can't be used with -A." << endl;
+            return 1;
+        }
+    } else if (triage) {
+        if (optind == argc || multi || lanes || verify || !daemonSocket.empty() || !resumeFile.empty() || !agreementFile.empty()) {
+            usage();
+        }
+        if (!trace.empty() || !dumps.empty() || lowLatency || !cacheDir.empty() || perfCounters || clip || !indexFile.empty() || !region.empty()) {
+            cerr << "-t, -w, -l, -C, -P, -c, -X and -R can't be used with -Q." << endl;
+            return 1;
+        }
+    } else if (!daemonSocket.empty()) {
+        if (optind != argc || multi || lanes || verify || !resumeFile.empty() || workers <= 0) {
+            usage();
+        }
+        if (!trace.empty() || !dumps.empty() || lowLatency || !cacheDir.empty() || readAhead) {
+            cerr << "-t, -w, -l, -C and -r can't be used with -D." << endl;
+            return 1;
+        }
+    } else if (verify) {
+        if (optind != argc - 1 || multi || lanes || !resumeFile.empty() || !agreementFile.empty()) {
+            usage();
+        }
+        if (!trace.empty() || !dumps.empty() || lowLatency || !cacheDir.empty() || perfCounters) {
+            cerr << "-t, -w, -l, -C and -P can't be used with -V." << endl;
+            return 1;
+        }
+    } else if (multi || lanes) {
+        if (optind > argc - (multi ? 2 : 1) || !resumeFile.empty() || (!multi && !agreementFile.empty())) {
+            usage();
+        }
+        if (!trace.empty() || !dumps.empty() || lowLatency || !cacheDir.empty()) {
+            cerr << "-t, -w, -l and -C can't be used with -m or -L." << endl;
+            return 1;
+        }
+        if (perfCounters && !lanes) {
+            cerr << "-P can't be used with -m unless -L is given." << endl;
+            return 1;
+        }
+        if (fusedFront && lanes) {
+            cerr << "-f can't be used with -L." << endl;
+            return 1;
+        }
+    } else if (optind != argc - (resumeFile.empty() ? 1 : 0) || !agreementFile.empty() || (fusedFront && !resumeFile.empty())) {
         usage();
     }
 
@@ -74,54 +777,563 @@ int main(int argc, char **argv)
         return trace.find(ch) != trace.end();
     };
 
-    string waveFile = argv[optind];
+    // How much each stage asks for from the one before it at once, with
+    // `c' for the frame filter and `o' for how many characters are 
+    // decoded per write to the output. Low latency mode passes small 
+    // blocks down the chain, and each stage returns early rather than
+    // wait for a full block. Otherwise the sizes found by -A for this
+    // machine are used, if it's been run.
+    //
+    map<char, int> blocks{ { 'z', 4096 }, { 'f', 1024 }, { 'n', 1024 }, { 'b', 1024 }, { 'c', 1024 }, { 'o', 4096 } };
+    if (lowLatency) {
+        blocks = { { 'z', 64 }, { 'f', 16 }, { 'n', 8 }, { 'b', 8 }, { 'c', 16 }, { 'o', 16 } };
+    } else if (!tune) {
+        string config = BlockTuner::configPath();
+        try {
+            BlockTuner::load(config, blocks);
+        } catch (runtime_error re) {
+            cerr << config << ": " << re.what() << " Ignoring it." << endl;
+        }
+    }
+    for (auto &block : blockSizes) {
+        if (blocks.find(block.first) == blocks.end() || block.second <= 0) {
+            cerr << "invalid block size for stage `" << block.first << "'." << endl;
+            return 1;
+        }
+        blocks[block.first] = block.second;
+    }
+
+    DecodeOptions opts;
+    opts.clip = clip;
+    opts.dcwin = dcwin;
+    opts.poles = poles;
+    opts.negate = negateZeroCross;
+    opts.adaptive = adaptive;
+    opts.recoverClock = recoverClock;
+    opts.fused = fusedFront;
+    opts.baud = baud;
+    opts.quality = quality;
+    opts.qualitySkip = qualitySkip;
+    opts.blocks = blocks;
+
+    if (!daemonSocket.empty()) {
+        try {
+            DecodeDaemon daemon{ daemonSocket, workers, opts, perfCounters };
+            daemon.run();
+        } catch (runtime_error re) {
+            cerr << daemonSocket << ": " << re.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (verify) {
+        return verifyFused(argv[optind], opts);
+    }
+
+    if (tune) {
+        return tuneBlocks(optind < argc ? argv[optind] : "", opts);
+    }
+
+    if (triage) {
+        return triageMany(vector<string>(argv + optind, argv + argc), opts, readAhead, stats);
+    }
+
+    if (multi || lanes) {
+        return decodeMany(vector<string>(argv + optind, argv + argc), opts, readAhead, lanes, multi, agreementFile, stats, perfCounters);
+    }
+
+    // When resuming from a dump, the stages up to and including the one
+    // in the dump are replaced by reading the dump, and there's no wave
+    // file.
+    //
+    const string STAGES = "zfnb";
+    unique_ptr<DumpReader> resume;
+    size_t firstStage = 0;
+
+    if (!resumeFile.empty()) {
+        try {
+            resume = unique_ptr<DumpReader>{ new DumpReader{ resumeFile } };
+            firstStage = STAGES.find(resume->getStage()) + 1;
+        } catch (runtime_error re) {
+            cerr << resumeFile << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    auto buildStage = [&](char stage) {
+        return STAGES.find(stage) >= firstStage;
+    };
+
+    for (auto &dump : dumps) {
+        if (STAGES.find(dump.first) == string::npos || !buildStage(dump.first) || (fusedFront && dump.first == 'z')) {
+            cerr << "cannot dump stage `" << dump.first << "'." << endl;
+            return 1;
+        }
+    }
+
+    string waveFile = resume ? resumeFile : argv[optind];
     vector<int16_t> data;
 
-    unique_ptr<WaveReader> reader;
+    unique_ptr<AudioReader> reader;
 
-    try {
-        reader = unique_ptr<WaveReader>{ new WaveReader{ waveFile } };
-        if (reader->getSampleRate() != 44100) {
-            cerr << "file must be 44kHz" << endl;
+    if (!resume) {
+        try {
+            reader = AudioReader::open(waveFile);
+            if (reader->getSampleRate() != 44100) {
+                cerr << "file must be 44kHz" << endl;
+                return 1;
+            }
+            if (secondPass && reader->isStreaming()) {
+                cerr << "-K needs a wave file it can read again." << endl;
+                return 1;
+            }
+        } catch (runtime_error re) {
+            cerr << waveFile << ": " << re.what() << endl;
             return 1;
         }
+    }
+
+    // With -R, the index given with -X is read to find the region rather
+    // than written.
+    //
+    unique_ptr<IndexReader> indexReader;
+    unique_ptr<IndexWriter> indexWriter;
+
+    try {
+        if (region.empty() && !indexFile.empty()) {
+            indexWriter = unique_ptr<IndexWriter>{ new IndexWriter{ indexFile } };
+        } else if (!indexFile.empty()) {
+            indexReader = unique_ptr<IndexReader>{ new IndexReader{ indexFile } };
+        }
     } catch (runtime_error re) {
-        cerr << waveFile << ": " << re.what() << endl;
+        cerr << indexFile << ": " << re.what() << endl;
         return 1;
     }
 
+    // one line per character: the sample it starts at, how sure the
+    // decode is of it, and the character code in hex
+    unique_ptr<ofstream> confidenceOut;
+    if (!confidenceFile.empty()) {
+        confidenceOut = unique_ptr<ofstream>{ new ofstream{ confidenceFile } };
+        if (!*confidenceOut) {
+            cerr << confidenceFile << ": failed to open file." << endl;
+            return 1;
+        }
+    }
+
+    auto rate = [&](uint64_t sample, double confidence, char ch) {
+        *confidenceOut << sample << " " << confidence << " " << std::hex << int(static_cast<uint8_t>(ch)) << std::dec << "\n";
+    };
+
+    uint64_t regionFirst = 0;
+    uint64_t regionLast = 0;
+
+    if (!region.empty()) {
+        try {
+            regionFirst = regionEnd(region.substr(0, region.find(':')), indexReader.get());
+            regionLast = regionEnd(region.substr(region.find(':') + 1), indexReader.get());
+        } catch (runtime_error re) {
+            cerr << region << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    // The decode output depends only on the data chunk, the options
+    // which affect decoding and the version of the decoder. Traces, dumps, indexes and ratings are a side
+    // effect of the decode, so those runs are never cached, and nor are
+    // regions, which are quick to decode anyway.
+    //
+    unique_ptr<DecodeCache> cache;
+    uint64_t dataHash = 0;
+    string params;
+
+    if (!cacheDir.empty() && trace.empty() && dumps.empty() && !indexWriter && !confidenceOut && region.empty() && reader && !reader->isStreaming()) {
+        stringstream ss;
+        ss << "v=" << DECODE_VERSION << " c=" << clip << " d=" << dcwin << " n=" << negateZeroCross << " a=" << adaptive << " p=" << recoverClock;
+        if (poles) {
+            ss << " i=" << poles;
+        }
+        if (baud != BandTracker::BAUD_RATE) {
+            ss << " B=" << baud;
+        }
+        if (quality) {
+            ss << " q=" << quality << (qualitySkip ? ":skip" : "");
+        }
+        if (secondPass) {
+            ss << " K=1";
+        }
+        params = ss.str();
+
+        try {
+            cache = unique_ptr<DecodeCache>{ new DecodeCache{ cacheDir, cacheMegabytes << 20 } };
+            dataHash = reader->hashData();
+
+            string output;
+            string cachedStats;
+            if (cache->lookup(dataHash, params, output, cachedStats)) {
+                cout << output << endl;
+                if (stats) {
+                    cerr << cachedStats << "cache hit" << endl;
+                }
+                return 0;
+            }
+        } catch (runtime_error re) {
+            cerr << waveFile << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    // Counting starts here so the cache lookup isn't charged to anything
+    unique_ptr<PerfCounters> perf;
+    if (perfCounters) {
+        try {
+            perf = unique_ptr<PerfCounters>{ new PerfCounters{} };
+        } catch (runtime_error re) {
+            cerr << re.what() << endl;
+            return 1;
+        }
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
     // NB we have to do this before constructing the filter chain as 
     // filters may prefill data in their constructors.
-    if (clip) {
+    if (clip && reader) {
         reader->skip(clip);
     }
 
-    DCFilter dcFilter{ *reader.get(), dcwin };
-    ZeroCrossFilter zeroCross{ dcFilter, reader->getSampleRate(), negateZeroCross };
-    if (traceClass('z')) { zeroCross.trace(); }
+    // Where the decode starts in the file, which times in the chain are
+    // from
+    unique_ptr<RegionSource> regionSource;
+    SampleSource *source = reader.get();
+    uint64_t startSample = reader ? clip : 0;
+
+    if (!region.empty()) {
+        try {
+            regionSource = unique_ptr<RegionSource>{ new RegionSource{ *reader, regionFirst, regionLast } };
+        } catch (runtime_error re) {
+            cerr << region << ": " << re.what() << endl;
+            return 1;
+        }
+        source = regionSource.get();
+        startSample = regionSource->getStart();
+    }
+
+    unique_ptr<QualityMonitor> monitor;
+    if (quality) {
+        monitor = unique_ptr<QualityMonitor>{ new QualityMonitor{ quality, qualitySkip ? QualityMonitor::Skip : QualityMonitor::Abort } };
+        source = &monitor->gate(*source);
+    }
+
+    if (readAhead && reader) {
+        reader->startReadAhead(readAhead);
+    }
+
+    // Build the chain. Each stage is followed by a tap if its output is
+    // being dumped.
+    //
+    vector<unique_ptr<DumpWriter>> dumpWriters;
+    unique_ptr<Tracer> tracer;
+    auto dumpFor = [&](char stage) -> DumpWriter * {
+        auto it = dumps.find(stage);
+        if (it == dumps.end()) {
+            return nullptr;
+        }
+        dumpWriters.push_back(unique_ptr<DumpWriter>{ new DumpWriter{ it->second, stage } });
+        return dumpWriters.back().get();
+    };
+
+    unique_ptr<DCFilter> dcFilter;
+    unique_ptr<ZeroCrossFilter> zeroCross;
+    unique_ptr<FreqSpanFilter> freqSpan;
+    unique_ptr<FusedFrontEnd> fused;
+    unique_ptr<BaudFilter> baudFilter;
+    unique_ptr<DeNoiseFilter> denoise;
+    unique_ptr<BitstreamFilter> bitstream;
+    vector<unique_ptr<CrossingSource>> crossingTaps;
+    vector<unique_ptr<SpanSource>> spanTaps;
+    vector<unique_ptr<BitSource>> bitTaps;
+    unique_ptr<LatencyMeter> latency;
+
+    CrossingSource *crossings = resume.get();
+    SpanSource *freqSpans = resume.get();
+    SpanSource *spans = resume.get();
+    BitSource *bits = resume.get();
+
+    try {
+        // Times in the trace are from the start of the decode, so the
+        // trace records where that is in the wave file.
+        if (!trace.empty()) {
+            int sampleRate = reader ? reader->getSampleRate() : 44100;
+            tracer = unique_ptr<Tracer>{ new Tracer{ traceFile, sampleRate, startSample } };
+        }
+
+        // The fused front end does the work of the first two stages, so
+        // it has the same traces and the spans can still be dumped.
+        //
+        if (fusedFront) {
+            fused = unique_ptr<FusedFrontEnd>{ new FusedFrontEnd{ *source, dcwin, opts.dcMode(), negateZeroCross, blocks['z'] } };
+            if (lowLatency) {
+                latency = unique_ptr<LatencyMeter>{ new LatencyMeter{ reader->getSampleRate() } };
+                fused->meter(*latency);
+                fused->flush();
+            }
+            if (traceClass('z')) { fused->traceCrossings(tracer->ring('z')); }
+            if (traceClass('f')) { fused->traceSpans(tracer->ring('f')); }
+            if (adaptive) { fused->adapt(); }
+            freqSpans = fused.get();
+
+            if (DumpWriter *dump = dumpFor('f')) {
+                spanTaps.push_back(unique_ptr<SpanSource>{ new SpanTap{ *freqSpans, *dump } });
+                freqSpans = spanTaps.back().get();
+            }
+        }
 
-    FreqSpanFilter freqSpan{ zeroCross };
-    if (traceClass('f')) { freqSpan.trace(); }
+        if (!fusedFront && buildStage('z')) {
+            dcFilter = unique_ptr<DCFilter>{ new DCFilter{ *source, dcwin, opts.dcMode() } };
+            if (lowLatency) {
+                latency = unique_ptr<LatencyMeter>{ new LatencyMeter{ reader->getSampleRate() } };
+                dcFilter->meter(*latency);
+            }
+
+            zeroCross = unique_ptr<ZeroCrossFilter>{ new ZeroCrossFilter{ *dcFilter, reader->getSampleRate(), negateZeroCross, blocks['z'] } };
+            if (traceClass('z')) { zeroCross->trace(tracer->ring('z')); }
+            if (lowLatency) { zeroCross->flush(); }
+            crossings = zeroCross.get();
+
+            if (DumpWriter *dump = dumpFor('z')) {
+                crossingTaps.push_back(unique_ptr<CrossingSource>{ new CrossingTap{ *crossings, *dump } });
+                crossings = crossingTaps.back().get();
+            }
+        }
+
+        if (!fusedFront && buildStage('f')) {
+            freqSpan = unique_ptr<FreqSpanFilter>{ new FreqSpanFilter{ *crossings, blocks['f'] } };
+            if (traceClass('f')) { freqSpan->trace(tracer->ring('f')); }
+            if (lowLatency) { freqSpan->flush(); }
+            if (adaptive) { freqSpan->adapt(); }
+            freqSpans = freqSpan.get();
+
+            if (DumpWriter *dump = dumpFor('f')) {
+                spanTaps.push_back(unique_ptr<SpanSource>{ new SpanTap{ *freqSpans, *dump } });
+                freqSpans = spanTaps.back().get();
+            }
+        }
+
+        if (buildStage('n')) {
+            if (monitor) {
+                freqSpans = &monitor->tap(*freqSpans);
+            }
+
+            if (baud != BandTracker::BAUD_RATE) {
+                baudFilter = unique_ptr<BaudFilter>{ new BaudFilter{ *freqSpans, baud, blocks['n'] } };
+                if (lowLatency) { baudFilter->flush(); }
+                freqSpans = baudFilter.get();
+            }
+
+            denoise = unique_ptr<DeNoiseFilter>{ new DeNoiseFilter{ *freqSpans, blocks['n'] } };
+            if (lowLatency) { denoise->flush(); }
+            spans = denoise.get();
+
+            if (DumpWriter *dump = dumpFor('n')) {
+                spanTaps.push_back(unique_ptr<SpanSource>{ new SpanTap{ *spans, *dump } });
+                spans = spanTaps.back().get();
+            }
+        }
+
+        if (buildStage('b')) {
+            bitstream = unique_ptr<BitstreamFilter>{ new BitstreamFilter{ *spans, blocks['b'] } };
+            if (traceClass('b')) { bitstream->trace(tracer->ring('b')); }
+            if (lowLatency) { bitstream->flush(); }
+            if (recoverClock) { bitstream->recoverClock(); }
+            bits = bitstream.get();
+
+            if (DumpWriter *dump = dumpFor('b')) {
+                bitTaps.push_back(unique_ptr<BitSource>{ new BitTap{ *bits, *dump } });
+                bits = bitTaps.back().get();
+            }
+        }
+    } catch (runtime_error re) {
+        cerr << waveFile << ": " << re.what() << endl;
+        return 1;
+    }
 
-    DeNoiseFilter denoise{ freqSpan };
-    BitstreamFilter bitstream{ denoise };
-    if (traceClass('b')) { bitstream.trace(); }
+    FrameFilter frames{ *bits, blocks['c'] };
+    if (traceClass('c')) { frames.trace(tracer->ring('c')); }
+    if (lowLatency) { frames.flush(); }
+    if (monitor) { monitor->watch(frames); }
 
-    FrameFilter frames{ bitstream };
+    string output;
+    uint64_t nchars = 0;
+    double sampleRate = reader ? reader->getSampleRate() : 44100;
 
+    // With -K, what's decoded is kept for the second pass, and written
+    // out after it along with its index and ratings
+    string passChars;
+    vector<uint64_t> passSamples;
+    vector<double> passConfidences;
 
     while (true) {
-        vector<char> chunk = frames.getChars(4096);
+        vector<char> chunk = frames.getChars(blocks['o']);
         if (chunk.size() == 0) {
             break;
         }
 
+        // where each character starts in the file, to index or rate it or
+        // see if it's in the region
+        if (indexWriter || regionSource || confidenceOut || secondPass) {
+            auto &positions = frames.getPositions();
+            auto &confidences = frames.getConfidences();
+            vector<char> kept;
+
+            for (size_t i = 0; i < chunk.size(); i++) {
+                double start = monitor ? monitor->fileTime(positions[i].start) : positions[i].start;
+                uint64_t sample = startSample + uint64_t(std::llround(start * sampleRate));
+                if (regionSource && !regionSource->contains(sample)) {
+                    continue;
+                }
+
+                kept.push_back(chunk[i]);
+                if (secondPass) {
+                    passChars.push_back(chunk[i]);
+                    passSamples.push_back(sample);
+                    passConfidences.push_back(confidences[i]);
+                    continue;
+                }
+                if (indexWriter) {
+                    indexWriter->add(sample);
+                }
+                if (confidenceOut) {
+                    rate(sample, confidences[i], chunk[i]);
+                }
+            }
+
+            chunk = kept;
+        }
+
+        if (secondPass) {
+            continue;
+        }
+
         for (char t : chunk) {
             cout << t;
         }
+
+        if (lowLatency) {
+            cout << flush;
+        }
+
+        if (latency) {
+            for (auto &pos : frames.getPositions()) {
+                latency->charDecoded(pos.stop);
+            }
+        }
+
+        if (cache) {
+            output.append(chunk.begin(), chunk.end());
+        }
+        nchars += chunk.size();
+    }
+
+    unique_ptr<Redecoder> redecoder;
+    if (secondPass) {
+        try {
+            redecoder = unique_ptr<Redecoder>{ new Redecoder{ waveFile, opts } };
+            redecoder->run(passChars, passSamples, passConfidences);
+        } catch (runtime_error re) {
+            cerr << waveFile << ": " << re.what() << endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < passChars.size(); i++) {
+            if (indexWriter) {
+                indexWriter->add(passSamples[i]);
+            }
+            if (confidenceOut) {
+                rate(passSamples[i], passConfidences[i], passChars[i]);
+            }
+        }
+
+        cout << passChars;
+        if (cache) {
+            output = passChars;
+        }
+        nchars = passChars.size();
     }
 
     cout << endl;
 
+    if (confidenceOut && !confidenceOut->flush()) {
+        cerr << confidenceFile << ": failed writing file." << endl;
+        return 1;
+    }
+
+    if (monitor && monitor->isAborted()) {
+        cerr << waveFile << ": poor signal, gave up at " << monitor->getAbortTime() + double(startSample) / sampleRate << " seconds." << endl;
+    }
+
+    if (indexWriter) {
+        try {
+            indexWriter->flush();
+        } catch (runtime_error re) {
+            cerr << indexFile << ": " << re.what() << endl;
+            return 1;
+        }
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+    stringstream ss;
+    if (reader) {
+        ss << "samples " << reader->getSampleCount() << endl;
+    }
+    if (baudFilter) {
+        ss << "baud";
+        for (int rate : baudFilter->getRecordBauds()) {
+            ss << " " << rate;
+        }
+        ss << endl;
+    }
+    if (monitor) {
+        ss << monitor->getStats();
+    }
+    if (bitstream && recoverClock) {
+        ss << "pll-locked " << double(bitstream->getLockedBits()) / std::max<uint64_t>(bitstream->getBitCount(), 1) << endl;
+    }
+    if (redecoder) {
+        ss << redecoder->getStats();
+    }
+    ss
+        << "chars " << nchars << endl
+        << "decode-seconds " << elapsed.count() << endl;
+    if (latency) {
+        ss
+            << "latency-p50-ms " << latency->getPercentile(50) * 1000 << endl
+            << "latency-p99-ms " << latency->getPercentile(99) * 1000 << endl;
+    }
+    if (reader) {
+        ss
+            << "io-wait-seconds " << reader->getIoWaitSeconds() << endl
+            << "compute-seconds " << elapsed.count() - reader->getIoWaitSeconds() << endl;
+    }
+    string runStats = ss.str();
+
+    if (stats) {
+        cerr << runStats;
+    }
+
+    if (perf) {
+        perf->report(cerr);
+    }
+
+    if (cache) {
+        try {
+            cache->store(dataHash, params, output, runStats);
+        } catch (runtime_error re) {
+            cerr << cacheDir << ": " << re.what() << endl;
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,168 @@
+#include "perfctr.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::endl;
+using std::ostream;
+using std::runtime_error;
+using std::string;
+
+namespace {
+    struct Counter {
+        uint32_t type;
+        uint64_t config;
+        const char *name;
+    };
+
+    const Counter COUNTERS[] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns" },
+    };
+
+    const char *STAGE_NAMES[] = { "other", "dc", "z", "f", "baud", "n", "b", "c", "dzf" };
+
+    int perfEventOpen(perf_event_attr &attr, int group)
+    {
+        return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+    }
+}
+
+thread_local PerfCounters *PerfCounters::active_ = nullptr;
+
+// Open the counters on this thread. Counters the hardware doesn't have
+// (as in most virtual machines) are left out of the report; if none can
+// be opened at all, that's an error.
+//
+PerfCounters::PerfCounters()
+    : leader_(-1)
+{
+    memset(last_, 0, sizeof(last_));
+    memset(totals_, 0, sizeof(totals_));
+
+    for (int i = 0; i < NCOUNTERS; i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = COUNTERS[i].type;
+        attr.config = COUNTERS[i].config;
+        attr.disabled = leader_ == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        int fd = perfEventOpen(attr, leader_);
+        if (fd == -1) {
+            slot_[i] = -1;
+            continue;
+        }
+
+        if (leader_ == -1) {
+            leader_ = fd;
+        }
+        slot_[i] = fds_.size();
+        fds_.push_back(fd);
+    }
+
+    if (leader_ == -1) {
+        throw runtime_error{ string{ "cannot open performance counters: " } + strerror(errno) + "." };
+    }
+
+    ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    read(last_);
+
+    stack_.push_back(Other);
+    active_ = this;
+}
+
+PerfCounters::~PerfCounters()
+{
+    active_ = nullptr;
+    for (int fd : fds_) {
+        close(fd);
+    }
+}
+
+// Start charging events to `stage'
+void PerfCounters::enter(Stage stage)
+{
+    charge();
+    stack_.push_back(stage);
+}
+
+// Go back to charging events to the stage which called the current one
+void PerfCounters::leave()
+{
+    charge();
+    stack_.pop_back();
+}
+
+// Print the counts for each stage which ran
+void PerfCounters::report(ostream &out)
+{
+    charge();
+
+    for (int stage = 0; stage < NSTAGES; stage++) {
+        uint64_t *totals = totals_[stage];
+        bool ran = false;
+        for (int i = 0; i < NCOUNTERS; i++) {
+            ran = ran || totals[i];
+        }
+        if (!ran) {
+            continue;
+        }
+
+        out << "perf-" << STAGE_NAMES[stage];
+        for (int i = 0; i < NCOUNTERS; i++) {
+            if (slot_[i] != -1) {
+                out << " " << COUNTERS[i].name << " " << totals[i];
+            }
+        }
+        if (slot_[0] != -1 && slot_[1] != -1 && totals[0]) {
+            out << " ipc " << std::setprecision(3) << double(totals[1]) / totals[0];
+        }
+        out << endl;
+    }
+}
+
+// Read the current count of each event, by counter index
+void PerfCounters::read(uint64_t *values)
+{
+    uint64_t buf[1 + NCOUNTERS];
+    if (::read(leader_, buf, sizeof(buf)) < ssize_t(sizeof(uint64_t) * (1 + fds_.size()))) {
+        return;
+    }
+
+    for (int i = 0; i < NCOUNTERS; i++) {
+        if (slot_[i] != -1) {
+            values[i] = buf[1 + slot_[i]];
+        }
+    }
+}
+
+// Charge the events since the last switch to the running stage
+void PerfCounters::charge()
+{
+    uint64_t now[NCOUNTERS];
+    memcpy(now, last_, sizeof(now));
+    read(now);
+
+    uint64_t *totals = totals_[stack_.back()];
+    for (int i = 0; i < NCOUNTERS; i++) {
+        totals[i] += now[i] - last_[i];
+    }
+    memcpy(last_, now, sizeof(last_));
+}
@@ -0,0 +1,78 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counts hardware events (cycles, instructions, cache and branch misses)
+// and CPU time with perf_event_open and charges them to whichever stage of the decoder
+// is running. Stages mark themselves with a PerfScope; since stages pull
+// from the ones before them, the scopes nest, and counts are charged only
+// to the innermost stage. Anything outside all stages is charged to
+// `other'. Only the thread which created the counters is counted.
+//
+class PerfCounters {
+public:
+    enum Stage {
+        Other,
+        DC,
+        ZeroCross,
+        FreqSpan,
+        Baud,
+        DeNoise,
+        Bitstream,
+        Frame,
+        Fused,          // DC, ZeroCross and FreqSpan in one (see -f)
+        NSTAGES
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    static PerfCounters *active() { return active_; }
+
+    void enter(Stage stage);
+    void leave();
+    void report(std::ostream &out);
+
+private:
+    static const int NCOUNTERS = 5;
+    static thread_local PerfCounters *active_;
+
+    int leader_;
+    std::vector<int> fds_;
+    int slot_[NCOUNTERS];
+    std::vector<Stage> stack_;
+    uint64_t last_[NCOUNTERS];
+    uint64_t totals_[NSTAGES][NCOUNTERS];
+
+    void read(uint64_t *values);
+    void charge();
+};
+
+// Charges hardware events to `stage' for as long as it's in scope, when
+// counting is on.
+//
+class PerfScope {
+public:
+    PerfScope(PerfCounters::Stage stage)
+        : perf_(PerfCounters::active())
+    {
+        if (perf_) {
+            perf_->enter(stage);
+        }
+    }
+
+    ~PerfScope()
+    {
+        if (perf_) {
+            perf_->leave();
+        }
+    }
+
+private:
+    PerfCounters *perf_;
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probe points for tracing the decoder with perf, bpftrace and the 
+// like, e.g.
+//
+//   bpftrace -e 'usdt:./osiwave:osiwave:bits_return { @[arg1] = count(); }'
+//
+// Each stage has an `_entry' probe with the size of the block asked for,
+// and a `_return' probe with the size asked for and the size returned. If
+// the systemtap headers aren't installed, the probes compile to nothing.
+//
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define OSIWAVE_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef OSIWAVE_HAVE_SDT
+#define OSIWAVE_PROBE1(name, a) DTRACE_PROBE1(osiwave, name, a)
+#define OSIWAVE_PROBE2(name, a, b) DTRACE_PROBE2(osiwave, name, a, b)
+#else
+// the arguments aren't evaluated, but still count as used
+#define OSIWAVE_PROBE1(name, a) do { (void)sizeof(a); } while (0)
+#define OSIWAVE_PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#endif
+
+#endif
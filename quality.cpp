@@ -0,0 +1,380 @@
+#include "quality.h"
+
+#include "frameflt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::endl;
+using std::string;
+using std::stringstream;
+using std::unique_ptr;
+using std::vector;
+
+using Span = SpanSource::Span;
+
+namespace {
+    // The decode is judged on stretches of this many seconds of spans.
+    // A stretch is bad if more than NOISY of it is noise, or if the
+    // frames are bad: more than REJECTED of the candidate frames were
+    // rejected, or fewer than PRINTABLE of the characters accepted
+    // weren't NUL. The frame filter is a few blocks behind the spans, so
+    // the frames are judged whenever there have been at least MIN_FRAMES
+    // more candidates, and stay good or bad until the next time.
+    //
+    const double WINDOW = 0.5;
+    const double NOISY = 0.5;
+    const double REJECTED = 0.5;
+    const double PRINTABLE = 0.5;
+    const uint64_t MIN_FRAMES = 8;
+
+    // Samples are checked for a tone in blocks of this many. A block has
+    // one if it has more than MIN_LEVEL RMS and as many zero crossings as
+    // something between MIN_FREQ and MAX_FREQ would have (a bit wider than
+    // the bands, for tapes off speed.) When skipping ahead, the tone has
+    // come back after SETTLE such blocks in a row, and decoding starts
+    // again WARMUP seconds before that so the filters have settled by the
+    // time the tone starts.
+    //
+    const size_t BLOCK = 1024;
+    const int SETTLE = 4;
+    const double MIN_LEVEL = 100;
+    const double MIN_FREQ = 900;
+    const double MAX_FREQ = 3000;
+    const double WARMUP = 0.25;
+}
+
+QualityMonitor::QualityMonitor(double seconds, Action action)
+    : seconds_(seconds)
+    , action_(action)
+    , frames_(nullptr)
+    , sampleRate_(44100)
+    , aborted_(false)
+    , abortTime_(0)
+    , windowStart_(0)
+    , noise_(0)
+    , total_(0)
+    , accepted_(0)
+    , rejected_(0)
+    , printable_(0)
+    , badFrames_(false)
+    , badSince_(0)
+    , bad_(false)
+{
+}
+
+// Read samples through the monitor, so it can skip ahead. Returns the
+// source the front end should read.
+//
+SampleSource &QualityMonitor::gate(SampleSource &src)
+{
+    sampleRate_ = src.getSampleRate();
+    gate_ = unique_ptr<Gate>{ new Gate{ src, *this } };
+    return *gate_;
+}
+
+// Watch the spans from the front end. Returns the source the rest of the
+// chain should read.
+//
+SpanSource &QualityMonitor::tap(SpanSource &spans)
+{
+    tap_ = unique_ptr<Tap>{ new Tap{ spans, *this } };
+    return *tap_;
+}
+
+// Count the frames found by `frames' towards how the decode is going
+void QualityMonitor::watch(const FrameFilter &frames)
+{
+    frames_ = &frames;
+}
+
+double QualityMonitor::getSkippedSeconds() const
+{
+    uint64_t samples = 0;
+    for (auto &jump : skips_) {
+        samples += jump.samples;
+    }
+    return samples / sampleRate_;
+}
+
+double QualityMonitor::fileTime(double t) const
+{
+    double at = t * sampleRate_;
+    for (auto &jump : skips_) {
+        if (jump.at <= at) {
+            t += jump.samples / sampleRate_;
+        }
+    }
+    return t;
+}
+
+string QualityMonitor::getStats() const
+{
+    stringstream ss;
+    if (aborted_) {
+        ss << "quality-abort-seconds " << getAbortTime() << endl;
+    }
+    if (action_ == Skip) {
+        ss
+            << "quality-skips " << getSkips() << endl
+            << "quality-skipped-seconds " << getSkippedSeconds() << endl;
+    }
+    return ss.str();
+}
+
+// Count a span, and judge the stretch if it's over. Returns false if the
+// decode should end here.
+//
+bool QualityMonitor::addSpan(const Span &span)
+{
+    if (aborted_) {
+        return true;
+    }
+
+    if (span.value == SpanSource::Noise) {
+        noise_ += span.length;
+    }
+    total_ += span.length;
+
+    double end = span.start + span.length;
+    if (end - windowStart_ < WINDOW) {
+        return true;
+    }
+
+    return judge(end);
+}
+
+// Judge the stretch ending at `now', and act if things have been bad for
+// long enough. Returns false if the decode should end.
+//
+bool QualityMonitor::judge(double now)
+{
+    if (frames_) {
+        uint64_t accepted = frames_->getAccepted() - accepted_;
+        uint64_t rejected = frames_->getRejected() - rejected_;
+        uint64_t printable = frames_->getPrintable() - printable_;
+
+        if (accepted + rejected >= MIN_FRAMES) {
+            badFrames_ = rejected > REJECTED * (accepted + rejected) || printable < PRINTABLE * accepted;
+            accepted_ = frames_->getAccepted();
+            rejected_ = frames_->getRejected();
+            printable_ = frames_->getPrintable();
+        }
+    }
+
+    bool bad = noise_ > NOISY * total_ || badFrames_;
+
+    if (!bad) {
+        bad_ = false;
+    } else if (!bad_) {
+        bad_ = true;
+        badSince_ = windowStart_;
+    }
+
+    startWindow(now);
+    if (!bad_ || now - badSince_ < seconds_) {
+        return true;
+    }
+
+    return act(now);
+}
+
+// The decode has been poor for long enough at `now': skip ahead or end
+// it. Returns false if it should end.
+//
+bool QualityMonitor::act(double now)
+{
+    bad_ = false;
+    if (action_ == Skip && gate_) {
+        gate_->scan();
+        return true;
+    }
+
+    aborted_ = true;
+    abortTime_ = now;
+    return false;
+}
+
+// Start judging a new stretch at `now'
+void QualityMonitor::startWindow(double now)
+{
+    windowStart_ = now;
+    noise_ = 0;
+    total_ = 0;
+}
+
+QualityMonitor::Gate::Gate(SampleSource &src, QualityMonitor &monitor)
+    : src_(src)
+    , monitor_(monitor)
+    , scanning_(false)
+    , ended_(false)
+    , pos_(0)
+    , pendingIdx_(0)
+    , quiet_(0)
+{
+}
+
+void QualityMonitor::Gate::skip(uint32_t nsamples)
+{
+    src_.skip(nsamples);
+}
+
+// Pass on samples, unless skipping ahead
+vector<int16_t> QualityMonitor::Gate::readSamples(uint32_t nsamples)
+{
+    if (ended_) {
+        return {};
+    }
+
+    if (scanning_) {
+        scanning_ = false;
+        partial_.clear();
+        quiet_ = 0;
+        if (!findTone()) {
+            return {};
+        }
+    }
+
+    vector<int16_t> samples;
+    if (pendingIdx_ < pending_.size()) {
+        size_t n = std::min<size_t>(nsamples, pending_.size() - pendingIdx_);
+        samples.assign(pending_.begin() + pendingIdx_, pending_.begin() + pendingIdx_ + n);
+        pendingIdx_ += n;
+    } else {
+        samples = src_.readSamples(nsamples);
+    }
+
+    pos_ += samples.size();
+    listen(samples);
+    return samples;
+}
+
+// Check the samples passed on for a tone, a block at a time, and act if
+// there's been none for long enough
+void QualityMonitor::Gate::listen(const vector<int16_t> &samples)
+{
+    const int16_t *p = samples.data();
+    const int16_t *end = p + samples.size();
+
+    while (p != end) {
+        size_t n = std::min<size_t>(end - p, BLOCK - partial_.size());
+        const int16_t *block = p;
+        if (n < BLOCK) {
+            partial_.insert(partial_.end(), p, p + n);
+            block = partial_.data();
+        }
+        p += n;
+
+        if (partial_.size() && partial_.size() < BLOCK) {
+            continue;
+        }
+
+        quiet_ = active(block, BLOCK) ? 0 : quiet_ + BLOCK;
+        partial_.clear();
+
+        if (quiet_ >= monitor_.seconds_ * getSampleRate()) {
+            quiet_ = 0;
+            ended_ = !monitor_.act(double(pos_) / getSampleRate());
+            return;
+        }
+    }
+}
+
+// Read ahead until there's a tone, keeping the last little bit before it
+// to be passed on. Returns false at end of file.
+//
+bool QualityMonitor::Gate::findTone()
+{
+    size_t warmup = size_t(WARMUP * src_.getSampleRate()) + SETTLE * BLOCK;
+    vector<int16_t> recent;
+    uint64_t read = 0;
+    int run = 0;
+
+    // anything not yet passed on before the skip is dropped too
+    if (pendingIdx_ < pending_.size()) {
+        recent.assign(pending_.begin() + pendingIdx_, pending_.end());
+        read = recent.size();
+    }
+
+    while (run < SETTLE) {
+        vector<int16_t> block = src_.readSamples(BLOCK);
+        if (block.empty()) {
+            monitor_.skips_.push_back(Jump{ pos_, read });
+            return false;
+        }
+
+        run = active(block.data(), block.size()) ? run + 1 : 0;
+        recent.insert(recent.end(), block.begin(), block.end());
+        read += block.size();
+
+        if (recent.size() > 2 * warmup) {
+            recent.erase(recent.begin(), recent.end() - warmup);
+        }
+    }
+
+    size_t keep = std::min(recent.size(), warmup);
+    pending_.assign(recent.end() - keep, recent.end());
+    pendingIdx_ = 0;
+
+    monitor_.skips_.push_back(Jump{ pos_, read - keep });
+    return true;
+}
+
+// Does a block of samples look like it might have a tone in it?
+bool QualityMonitor::Gate::active(const int16_t *block, size_t n) const
+{
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += block[i];
+    }
+    int32_t mean = int32_t(sum / int64_t(n));
+
+    int64_t sumSquares = 0;
+    int crossings = 0;
+    bool prev = block[0] >= mean;
+    for (size_t i = 0; i < n; i++) {
+        int32_t y = block[i] - mean;
+        sumSquares += y * y;
+        bool pos = y >= 0;
+        crossings += pos != prev;
+        prev = pos;
+    }
+
+    double seconds = double(n) / src_.getSampleRate();
+    double rms = std::sqrt(double(sumSquares) / n);
+    double freq = crossings / 2.0 / seconds;
+
+    return rms >= MIN_LEVEL && freq >= MIN_FREQ && freq <= MAX_FREQ;
+}
+
+QualityMonitor::Tap::Tap(SpanSource &src, QualityMonitor &monitor)
+    : src_(src)
+    , monitor_(monitor)
+    , ended_(false)
+{
+}
+
+// Pass on spans, up to where the monitor ends the decode. (If the gate
+// ended it, the spans already made from what it passed on still come
+// through.)
+//
+vector<Span> QualityMonitor::Tap::getSpans(int nspans)
+{
+    if (ended_) {
+        return {};
+    }
+
+    vector<Span> spans = src_.getSpans(nspans);
+    for (size_t i = 0; i < spans.size(); i++) {
+        if (!monitor_.addSpan(spans[i])) {
+            spans.resize(i + 1);
+            ended_ = true;
+            break;
+        }
+    }
+
+    return spans;
+}
@@ -0,0 +1,131 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "stage.h"
+
+class FrameFilter;
+
+// Watches how well a decode is going, and when it's been going badly for
+// long enough, either ends it there or skips ahead to where there's a
+// tone on the tape again, so a blank or hopeless capture doesn't take as
+// long as a good one.
+//
+// It's judged on stretches of the spans the front end makes: how much of
+// each is noise, and of the frames found meanwhile, how many were
+// rejected and how many accepted characters were NUL. Leader, with no
+// frames at all, is fine. Hiss or silence may make no spans for minutes
+// at a time, so the samples are also checked for anything like a tone
+// before they go to the front end.
+//
+// The monitor is put into the chain in two places: as a gate in front of
+// the front end, through which it skips ahead (without the gate it can
+// only end the decode), and as a tap after it, where it watches the
+// spans. Times in the chain don't include what was skipped; fileTime()
+// puts it back.
+//
+class QualityMonitor {
+public:
+    enum Action {
+        Abort,      // end the decode
+        Skip,       // skip ahead to the next tone
+    };
+
+    QualityMonitor(double seconds, Action action);
+
+    SampleSource &gate(SampleSource &src);
+    SpanSource &tap(SpanSource &spans);
+    void watch(const FrameFilter &frames);
+
+    bool isAborted() const { return aborted_; }
+    double getAbortTime() const { return fileTime(abortTime_); }
+    int getSkips() const { return int(skips_.size()); }
+    double getSkippedSeconds() const;
+
+    // a time in the chain, as seconds from the start of the stream
+    double fileTime(double t) const;
+
+    // what was done, in the same form as -s
+    std::string getStats() const;
+
+private:
+    // Passes samples through, checking each block for a tone, until told
+    // to skip; then reads ahead until there's a tone again
+    class Gate : public SampleSource {
+    public:
+        Gate(SampleSource &src, QualityMonitor &monitor);
+
+        int getSampleRate() const override { return src_.getSampleRate(); }
+        void skip(uint32_t nsamples) override;
+        std::vector<int16_t> readSamples(uint32_t nsamples) override;
+
+        void scan() { scanning_ = true; }
+
+    private:
+        SampleSource &src_;
+        QualityMonitor &monitor_;
+        bool scanning_;
+        bool ended_;
+        uint64_t pos_;
+        std::vector<int16_t> pending_;
+        size_t pendingIdx_;
+        std::vector<int16_t> partial_;
+        uint64_t quiet_;
+
+        void listen(const std::vector<int16_t> &samples);
+        bool findTone();
+        bool active(const int16_t *block, size_t n) const;
+    };
+
+    // Watches the spans on their way to the rest of the chain
+    class Tap : public SpanSource {
+    public:
+        Tap(SpanSource &src, QualityMonitor &monitor);
+        std::vector<Span> getSpans(int nspans) override;
+
+    private:
+        SpanSource &src_;
+        QualityMonitor &monitor_;
+        bool ended_;
+    };
+
+    // a skip, at `at' samples into the chain, of `samples' samples
+    struct Jump {
+        uint64_t at;
+        uint64_t samples;
+    };
+
+    double seconds_;
+    Action action_;
+    std::unique_ptr<Gate> gate_;
+    std::unique_ptr<Tap> tap_;
+    const FrameFilter *frames_;
+    double sampleRate_;
+
+    bool aborted_;
+    double abortTime_;
+    std::vector<Jump> skips_;
+
+    // the stretch being judged, the frames counted so far when they were
+    // last judged, and how long it's been bad
+    double windowStart_;
+    double noise_;
+    double total_;
+    uint64_t accepted_;
+    uint64_t rejected_;
+    uint64_t printable_;
+    bool badFrames_;
+    double badSince_;
+    bool bad_;
+
+    bool addSpan(const SpanSource::Span &span);
+    bool judge(double now);
+    bool act(double now);
+    void startWindow(double now);
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "redecode.h"
+
+#include "audio.h"
+#include "region.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::endl;
+using std::pair;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace {
+    // Characters rated below LOW are decoded again. Ones no more than JOIN
+    // characters apart go in the same stretch, which takes in CONTEXT
+    // characters either side so the ends are anchored on good ones.
+    //
+    const double LOW = 0.5;
+    const size_t JOIN = 8;
+    const size_t CONTEXT = 2;
+
+    // A stretch is scored by how sure the decode is of its characters on
+    // average, and another decode has to beat the first by MARGIN to
+    // replace it. It also has to fit its timing at least as well: the gaps
+    // between its characters, in character periods of CHAR_BITS bits,
+    // call for some number of characters, and it can't be further from
+    // that than the first decode was. So it can't win by dropping doubtful
+    // characters, which leaves gaps, or by adding junk it's sure of, which
+    // crowds them. A gap of more than PAUSE periods is a pause, not
+    // characters lost.
+    //
+    const double MARGIN = 0.1;
+    const int CHAR_BITS = 11;
+    const double PAUSE = 4.5;
+
+    double score(const vector<double> &confidences, size_t first, size_t last)
+    {
+        double sum = 0;
+        for (size_t i = first; i < last; i++) {
+            sum += confidences[i];
+        }
+        return last > first ? sum / (last - first) : 0;
+    }
+
+    // The median number of samples from one character to the next
+    double medianGap(const vector<uint64_t> &samples)
+    {
+        vector<uint64_t> gaps;
+        for (size_t i = 1; i < samples.size(); i++) {
+            gaps.push_back(samples[i] - samples[i - 1]);
+        }
+        if (gaps.empty()) {
+            return 0;
+        }
+        std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+        return double(gaps[gaps.size() / 2]);
+    }
+
+    // How far the number of characters from `first' to `last' is from the
+    // number the gaps between them call for
+    size_t misfit(const vector<uint64_t> &samples, size_t first, size_t last, double period)
+    {
+        long long want = 1;
+        for (size_t i = first + 1; i < last; i++) {
+            double gap = period > 0 ? (samples[i] - samples[i - 1]) / period : 1;
+            want += gap > PAUSE ? 1 : std::llround(gap);
+        }
+        long long count = last - first;
+        return size_t(std::llabs(count - want));
+    }
+}
+
+Redecoder::Redecoder(const string &fname, const DecodeOptions &opts)
+    : fname_(fname)
+    , regions_(0)
+    , replaced_(0)
+    , seconds_(0)
+    , sampleRate_(AudioReader::open(fname)->getSampleRate())
+    , baud_(opts.baud)
+{
+    // regions are found from the start of the file, so there's no clip,
+    // and they're short enough not to need watching
+    for (int flip = 1; flip < 4; flip++) {
+        DecodeOptions alt = opts;
+        alt.clip = 0;
+        alt.quality = 0;
+        if (flip & 1) {
+            alt.adaptive = !alt.adaptive;
+        }
+        if (flip & 2) {
+            alt.recoverClock = !alt.recoverClock;
+        }
+        alternates_.push_back(alt);
+    }
+}
+
+void Redecoder::run(string &chars, vector<uint64_t> &samples, vector<double> &confidences)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    // find the stretches, as [first, last) ranges of characters
+    vector<pair<size_t, size_t>> stretches;
+    for (size_t i = 0; i < chars.size(); i++) {
+        if (confidences[i] >= LOW) {
+            continue;
+        }
+
+        size_t first = i > CONTEXT ? i - CONTEXT : 0;
+        size_t last = std::min(chars.size(), i + CONTEXT + 1);
+        if (stretches.size() && first <= stretches.back().second + JOIN) {
+            stretches.back().second = last;
+        } else {
+            stretches.push_back({ first, last });
+        }
+    }
+
+    double charPeriod = baud_ ? double(sampleRate_) * CHAR_BITS / baud_ : medianGap(samples);
+
+    Attempt out;
+    size_t next = 0;
+
+    auto keep = [&](const string &c, const vector<uint64_t> &s, const vector<double> &k, size_t first, size_t last) {
+        out.chars.append(c.begin() + first, c.begin() + last);
+        out.samples.insert(out.samples.end(), s.begin() + first, s.begin() + last);
+        out.confidences.insert(out.confidences.end(), k.begin() + first, k.begin() + last);
+    };
+
+    for (auto &stretch : stretches) {
+        keep(chars, samples, confidences, next, stretch.first);
+        next = stretch.second;
+        regions_++;
+
+        Attempt best;
+        bool found = false;
+        size_t fit = misfit(samples, stretch.first, stretch.second, charPeriod);
+        double bar = score(confidences, stretch.first, stretch.second) + MARGIN;
+
+        for (auto &alt : alternates_) {
+            Attempt attempt = decode(samples[stretch.first], samples[stretch.second - 1], alt);
+            if (misfit(attempt.samples, 0, attempt.samples.size(), charPeriod) <= fit && attempt.score > bar) {
+                bar = attempt.score;
+                best = std::move(attempt);
+                found = true;
+            }
+        }
+
+        if (found) {
+            keep(best.chars, best.samples, best.confidences, 0, best.chars.size());
+            replaced_++;
+        } else {
+            keep(chars, samples, confidences, stretch.first, stretch.second);
+        }
+    }
+    keep(chars, samples, confidences, next, chars.size());
+
+    chars = std::move(out.chars);
+    samples = std::move(out.samples);
+    confidences = std::move(out.confidences);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    seconds_ += elapsed.count();
+}
+
+// Decode samples `first' to `last' of the file with the given settings
+Redecoder::Attempt Redecoder::decode(uint64_t first, uint64_t last, const DecodeOptions &opts)
+{
+    auto reader = AudioReader::open(fname_);
+    RegionSource region{ *reader, first, last };
+    Decoder decoder{ region, opts };
+    decoder.run();
+
+    Attempt attempt;
+    auto &chars = decoder.getChars();
+    auto &positions = decoder.getPositions();
+    auto &confidences = decoder.getConfidences();
+
+    for (size_t i = 0; i < chars.size(); i++) {
+        uint64_t sample = region.getStart() + uint64_t(std::llround(positions[i].start * reader->getSampleRate()));
+        if (region.contains(sample)) {
+            attempt.chars.push_back(chars[i]);
+            attempt.samples.push_back(sample);
+            attempt.confidences.push_back(confidences[i]);
+        }
+    }
+
+    attempt.score = score(attempt.confidences, 0, attempt.confidences.size());
+    return attempt;
+}
+
+string Redecoder::getStats() const
+{
+    stringstream ss;
+    ss
+        << "second-pass-regions " << regions_ << endl
+        << "second-pass-replaced " << replaced_ << endl
+        << "second-pass-seconds " << seconds_ << endl;
+    return ss.str();
+}
@@ -0,0 +1,49 @@
+#ifndef REDECODE_H
+#define REDECODE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+
+// A second pass over the characters a decode wasn't sure of. Each stretch
+// of them is decoded again on its own from the wave file with other
+// settings (speed tracking and clock recovery each turned the other way,
+// then both), and replaced by whichever of those decodes is surest of
+// its characters on average, if it's clearly surer than the first pass
+// was and its characters fit their timing as well. That costs a
+// fraction of decoding the whole file again with each setting.
+//
+class Redecoder {
+public:
+    Redecoder(const std::string &fname, const DecodeOptions &opts);
+
+    // Go over a decode, given the characters with the sample each starts
+    // at and how sure of each the decode was, replacing stretches in place
+    void run(std::string &chars, std::vector<uint64_t> &samples, std::vector<double> &confidences);
+
+    // what was done, in the same form as -s
+    std::string getStats() const;
+
+private:
+    // the characters from one decode of a stretch
+    struct Attempt {
+        std::string chars;
+        std::vector<uint64_t> samples;
+        std::vector<double> confidences;
+        double score;
+    };
+
+    std::string fname_;
+    std::vector<DecodeOptions> alternates_;
+    int regions_;
+    int replaced_;
+    double seconds_;
+    int sampleRate_;
+    int baud_;
+
+    Attempt decode(uint64_t first, uint64_t last, const DecodeOptions &opts);
+};
+
+#endif
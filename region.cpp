@@ -0,0 +1,73 @@
+#include "region.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+using std::runtime_error;
+using std::vector;
+
+namespace {
+    // Seconds read before the region, long enough for several characters
+    // at 300 baud to go by so the framing is in step by the start of it,
+    // and after, long enough for a character at 300 baud plus the spans
+    // around it.
+    //
+    const double WARMUP = 0.25;
+    const double TAIL = 2.0;
+
+    // With tracking or clock recovery starting from scratch, a character
+    // can be found a sample or two away from where the whole decode put
+    // it, so the ends of the region are this fuzzy. It's well under half
+    // a character at 1200 baud.
+    //
+    const double SLOP = 0.004;
+}
+
+RegionSource::RegionSource(SampleSource &src, uint64_t first, uint64_t last)
+    : src_(src)
+    , first_(first)
+    , last_(last)
+    , slop_(uint64_t(SLOP * src.getSampleRate()))
+    , pos_(0)
+{
+    if (first > last) {
+        throw runtime_error{ "region ends before it starts." };
+    }
+
+    uint64_t warmup = uint64_t(WARMUP * src.getSampleRate());
+    start_ = first > warmup ? first - warmup : 0;
+    end_ = last + uint64_t(TAIL * src.getSampleRate());
+
+    // (skip takes at most 32 bits of samples, which is over a day)
+    if (start_) {
+        src_.skip(start_);
+    }
+    pos_ = start_;
+}
+
+bool RegionSource::contains(uint64_t sample) const
+{
+    return sample + slop_ >= first_ && sample <= last_ + slop_;
+}
+
+// Skip over some samples, but not past the end of the region
+void RegionSource::skip(uint32_t nsamples)
+{
+    uint32_t n = uint32_t(std::min<uint64_t>(nsamples, end_ - pos_));
+    src_.skip(n);
+    pos_ += n;
+}
+
+// Return the next `nsamples' samples, or fewer at the end of the region
+vector<int16_t> RegionSource::readSamples(uint32_t nsamples)
+{
+    uint32_t n = uint32_t(std::min<uint64_t>(nsamples, end_ - pos_));
+    if (n == 0) {
+        return {};
+    }
+
+    vector<int16_t> samples = src_.readSamples(n);
+    pos_ += samples.size();
+    return samples;
+}
@@ -0,0 +1,42 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <cstdint>
+#include <vector>
+
+#include "stage.h"
+
+// Reads just the part of a stream around samples [first, last], so a few
+// characters can be decoded again without reading the whole file. The
+// chain has no state worth keeping across a region, so it's simply
+// started a little before `first' to let the filters settle and the
+// framing lock on, and run a little past `last' so the last character is
+// finished. Which of the characters decoded are inside the region is up
+// to the caller (see contains()).
+//
+class RegionSource : public SampleSource {
+public:
+    RegionSource(SampleSource &src, uint64_t first, uint64_t last);
+
+    int getSampleRate() const override { return src_.getSampleRate(); }
+    void skip(uint32_t nsamples) override;
+    std::vector<int16_t> readSamples(uint32_t nsamples) override;
+
+    // where reading started, in samples from the start of the stream
+    uint64_t getStart() const { return start_; }
+
+    // does a character starting at `sample' (from the start of the
+    // stream) belong to the region?
+    bool contains(uint64_t sample) const;
+
+private:
+    SampleSource &src_;
+    uint64_t first_;
+    uint64_t last_;
+    uint64_t slop_;
+    uint64_t start_;
+    uint64_t pos_;
+    uint64_t end_;
+};
+
+#endif
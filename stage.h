@@ -0,0 +1,84 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The interfaces between stages of the decode chain. Each stage pulls
+// blocks of data from the stage before it through one of these, so a
+// stage may be fed from something other than the usual filter (for
+// example, a saved dump of a previous run.)
+//
+
+// A source of 16 bit mono audio samples.
+//
+class SampleSource {
+public:
+    virtual ~SampleSource() {}
+    virtual int getSampleRate() const = 0;
+    virtual void skip(uint32_t nsamples) = 0;
+    virtual std::vector<int16_t> readSamples(uint32_t nsamples) = 0;
+};
+
+// A source of zero crossing timestamps, in seconds from the start of the
+// stream.
+//
+class CrossingSource {
+public:
+    virtual ~CrossingSource() {}
+    virtual std::vector<double> getTimestamps(int ncross) = 0;
+};
+
+// A source of spans of similar frequency.
+//
+class SpanSource {
+public:
+    // a value decoded from the analog data
+    enum Value {
+        Space,   // 1200 hz => zero/space 
+        Mark,    // 2400 hz => one/mark
+        Noise,   // anything else
+    };
+
+    static std::string valueName(Value v);
+
+    // How clean the signal behind a span was, for rating the characters
+    // decoded from it. All zero is as clean as can be.
+    //
+    struct Evidence {
+        double edge;        // how near its cycles came to the edge of the band, 0 (middle) to 1
+        int noise;          // how many noise spans were merged into it
+        double offClock;    // how far its length was from a whole number of clocks, up to 0.5
+    };
+
+    // a span of one detected value in the analog data
+    struct Span {
+        Value value;
+        double start;   // time of the start of the span in seconds
+        double length;
+        int clocks;
+        double clock;   // length of one bit clock in seconds
+        Evidence evidence;
+    };
+
+    virtual ~SpanSource() {}
+    virtual std::vector<Span> getSpans(int nspans) = 0;
+};
+
+// A source of decoded bits.
+//
+class BitSource {
+public:
+    virtual ~BitSource() {}
+    virtual std::vector<bool> getBits(int nbits) = 0;
+
+    // The start time of each bit returned by the last call to getBits,
+    // or nothing if the source doesn't know.
+    virtual std::vector<double> getBitTimes() const { return {}; }
+
+    // Likewise, the evidence from the span each bit came from
+    virtual std::vector<SpanSource::Evidence> getBitEvidence() const { return {}; }
+};
+
+#endif
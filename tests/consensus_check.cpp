@@ -0,0 +1,122 @@
+// Checks consensus over damaged captures of a repeated listing. Repeated
+// text is the hard case: the same damage in different lines looks like
+// a place the captures line up. With light damage consensus has to do
+// at least as well as the best capture, and with damage too heavy to
+// line the captures up, at least as well as the reference.
+//
+#include "../consensus.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+    // seconds per character at 300 baud, with a start and two stop bits
+    const double CHAR_TIME = 11.0 / 300;
+
+    // Make a capture of `text' starting `leader' seconds in, losing,
+    // garbling or adding a character about one time in `rate'
+    Consensus::Capture damage(const string &text, uint32_t seed, int rate, double leader)
+    {
+        Consensus::Capture capture;
+        uint32_t rng = seed;
+
+        auto next = [&rng](int n) {
+            rng = rng * 1103515245 + 12345;
+            return int((rng >> 16) % n);
+        };
+
+        for (size_t i = 0; i < text.size(); i++) {
+            double t = leader + i * CHAR_TIME;
+            switch (next(rate)) {
+            case 0:
+                break;
+            case 1:
+                capture.chars.push_back(char('A' + next(26)));
+                capture.times.push_back(t);
+                break;
+            case 2:
+                capture.chars.push_back(char('a' + next(26)));
+                capture.times.push_back(t - CHAR_TIME / 2);
+                // fall through
+            default:
+                capture.chars.push_back(text[i]);
+                capture.times.push_back(t);
+                break;
+            }
+        }
+
+        return capture;
+    }
+
+    int distance(const string &a, const string &b)
+    {
+        vector<int> prev(b.size() + 1);
+        vector<int> curr(b.size() + 1);
+
+        for (size_t j = 0; j <= b.size(); j++) {
+            prev[j] = j;
+        }
+        for (size_t i = 1; i <= a.size(); i++) {
+            curr[0] = i;
+            for (size_t j = 1; j <= b.size(); j++) {
+                curr[j] = std::min({ prev[j] + 1, curr[j - 1] + 1, prev[j - 1] + (a[i - 1] != b[j - 1]) });
+            }
+            std::swap(prev, curr);
+        }
+        return prev[b.size()];
+    }
+}
+
+int main()
+{
+    string text;
+    for (int i = 0; i < 20; i++) {
+        text += "10 PRINT \"HELLO WORLD\"\r\n20 GOTO 10\r\n";
+    }
+
+    int failures = 0;
+
+    for (int rate : { 50, 8 }) {
+        for (uint32_t trial = 1; trial <= 20; trial++) {
+            vector<Consensus::Capture> captures{
+                damage(text, trial * 3 + 0, rate, 2.0),
+                damage(text, trial * 3 + 1, rate, 3.5),
+                damage(text, trial * 3 + 2, rate, 1.2),
+            };
+
+            Consensus consensus{ captures };
+            consensus.run();
+
+            int best = distance(text, captures[0].chars);
+            for (auto &capture : captures) {
+                best = std::min(best, distance(text, capture.chars));
+            }
+            int reference = distance(text, captures[consensus.getReference()].chars);
+            int voted = distance(text, consensus.getChars());
+            int limit = rate > 20 ? best : reference;
+
+            if (voted > limit) {
+                cerr 
+                    << "damage 1/" << rate << " trial " << trial << ": consensus is " << voted 
+                    << " edits from the listing, the best capture " << best << " and the reference " << reference << endl;
+                failures++;
+            }
+        }
+    }
+
+    if (failures) {
+        return 1;
+    }
+
+    cout << "consensus held up on repeated text" << endl;
+    return 0;
+}
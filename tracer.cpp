@@ -0,0 +1,202 @@
+#include "tracer.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::ios;
+using std::runtime_error;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+// The file format is a header:
+//   4 bytes  magic "OSWT"
+//   1 byte   format version
+//   4 bytes  sample rate
+//   8 bytes  sample offset in the wave file of time zero
+// followed by blocks of events, one per ring buffer flush:
+//   1 byte   stage
+//   4 bytes  event count
+//   events
+// Each event is an 8 byte double time, 4 byte float value, and one 
+// byte each of type, from and to. All words are little endian.
+//
+namespace {
+    const char MAGIC[] = "OSWT";
+    const int VERSION = 1;
+    const int EVENT_SIZE = 15;
+
+    // Store a little-endian word at `p' and advance past it
+    inline void store(char *&p, uint64_t w, int nbytes)
+    {
+        for (int i = 0; i < nbytes; i++) {
+            *p++ = static_cast<char>(w & 0xff);
+            w >>= 8;
+        }
+    }
+}
+
+TraceRing::TraceRing(Tracer &tracer, char stage)
+    : tracer_(tracer)
+    , stage_(stage)
+    , count_(0)
+{
+}
+
+// Write out the events in the ring
+void TraceRing::flush()
+{
+    if (count_) {
+        tracer_.write(stage_, events_, count_);
+        count_ = 0;
+    }
+}
+
+Tracer::Tracer(const string &fname, int sampleRate, uint64_t startSample)
+{
+    out_.open(fname, ios::binary|ios::trunc);
+    if (!out_) {
+        throw runtime_error{ "failed to open trace file " + fname + "." };
+    }
+
+    buf_.insert(buf_.end(), MAGIC, MAGIC + 4);
+    buf_.push_back(VERSION);
+    putWord(sampleRate, 4);
+    putWord(startSample, 8);
+    out_.write(buf_.data(), buf_.size());
+    buf_.clear();
+}
+
+// Flush whatever is left in the rings. A failed write here can only
+// lose the end of the trace.
+//
+Tracer::~Tracer()
+{
+    try {
+        for (auto &ring : rings_) {
+            ring.second->flush();
+        }
+    } catch (runtime_error) {
+    }
+}
+
+// Return the ring buffer for a stage, creating it if need be
+TraceRing &Tracer::ring(char stage)
+{
+    auto &ring = rings_[stage];
+    if (!ring) {
+        ring = unique_ptr<TraceRing>{ new TraceRing{ *this, stage } };
+    }
+    return *ring;
+}
+
+// Write a block of events
+void Tracer::write(char stage, const TraceEvent *events, int count)
+{
+    buf_.resize(5 + count * EVENT_SIZE);
+    char *p = buf_.data();
+
+    *p++ = stage;
+    store(p, count, 4);
+
+    for (int i = 0; i < count; i++) {
+        uint64_t time;
+        uint32_t value;
+        memcpy(&time, &events[i].time, sizeof(time));
+        memcpy(&value, &events[i].value, sizeof(value));
+
+        store(p, time, 8);
+        store(p, value, 4);
+        *p++ = events[i].type;
+        *p++ = events[i].from;
+        *p++ = events[i].to;
+    }
+
+    out_.write(buf_.data(), buf_.size());
+    if (!out_) {
+        throw runtime_error{ "failed writing trace file." };
+    }
+}
+
+// Append a little-endian word to the output buffer
+void Tracer::putWord(uint64_t w, int nbytes)
+{
+    for (int i = 0; i < nbytes; i++) {
+        buf_.push_back(static_cast<char>(w & 0xff));
+        w >>= 8;
+    }
+}
+
+TraceReader::TraceReader(const string &fname)
+    : sampleRate_(0)
+    , startSample_(0)
+    , bufIdx_(0)
+{
+    in_.open(fname, ios::binary);
+    if (!in_) {
+        throw runtime_error{ "failed to open file." };
+    }
+
+    buf_.resize(17);
+    if (!in_.read(buf_.data(), buf_.size()) || string(buf_.data(), 4) != MAGIC) {
+        throw runtime_error{ "file is not an osiwave trace." };
+    }
+
+    if (buf_[4] != VERSION) {
+        throw runtime_error{ "unsupported trace version." };
+    }
+
+    bufIdx_ = 5;
+    sampleRate_ = getWord(4);
+    startSample_ = getWord(8);
+    buf_.clear();
+    bufIdx_ = 0;
+}
+
+// Read the next event. Returns false at the end of the trace.
+//
+bool TraceReader::next(TraceEvent &ev)
+{
+    if (bufIdx_ == buf_.size()) {
+        char header[5];
+        if (!in_.read(header, sizeof(header))) {
+            return false;
+        }
+
+        buf_.assign(header, header + sizeof(header));
+        bufIdx_ = 0;
+        char stage = getWord(1);
+        uint32_t count = getWord(4);
+
+        buf_.resize(count * EVENT_SIZE + 1);
+        buf_[0] = stage;
+        if (!in_.read(buf_.data() + 1, count * EVENT_SIZE)) {
+            throw runtime_error{ "premature end of file on trace." };
+        }
+        bufIdx_ = 1;
+    }
+
+    uint64_t time = getWord(8);
+    uint32_t value = getWord(4);
+    memcpy(&ev.time, &time, sizeof(time));
+    memcpy(&ev.value, &value, sizeof(value));
+    ev.stage = buf_[0];
+    ev.type = getWord(1);
+    ev.from = getWord(1);
+    ev.to = getWord(1);
+
+    return true;
+}
+
+// Read a little-endian word from the buffered block
+uint64_t TraceReader::getWord(int nbytes)
+{
+    uint64_t w = 0;
+    for (int i = nbytes-1; i >= 0; i--) {
+        w = (w << 8) | static_cast<uint8_t>(buf_[bufIdx_ + i]);
+    }
+    bufIdx_ += nbytes;
+    return w;
+}
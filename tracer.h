@@ -0,0 +1,103 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Low overhead binary tracing of what the decoder is doing. Each traced 
+// stage records compact fixed size events into its own ring buffer, which
+// is written out to the trace file whenever it fills. The ositrace tool 
+// turns a trace file back into text or CSV.
+//
+struct TraceEvent {
+    enum Type {
+        Crossing,       // a zero crossing; value is 1 if it was in a run of zeroes
+        SpanChange,     // a new span; value is the frequency, from/to the span values
+        Bit,            // a decoded bit; value is the bit
+        FrameAccept,    // a character frame; value is the character
+        FrameReject,    // a candidate frame that failed framing
+    };
+
+    double time;        // seconds from the start of the stream
+    float value;
+    uint8_t stage;
+    uint8_t type;
+    uint8_t from;
+    uint8_t to;
+};
+
+class Tracer;
+
+class TraceRing {
+public:
+    TraceRing(Tracer &tracer, char stage);
+
+    void record(TraceEvent::Type type, double time, float value, int from = 0, int to = 0)
+    {
+        TraceEvent &ev = events_[count_++];
+        ev.time = time;
+        ev.value = value;
+        ev.stage = stage_;
+        ev.type = type;
+        ev.from = from;
+        ev.to = to;
+
+        if (count_ == SIZE) {
+            flush();
+        }
+    }
+
+    void flush();
+
+private:
+    static const int SIZE = 4096;
+
+    Tracer &tracer_;
+    char stage_;
+    int count_;
+    TraceEvent events_[SIZE];
+};
+
+class Tracer {
+public:
+    Tracer(const std::string &fname, int sampleRate, uint64_t startSample);
+    ~Tracer();
+
+    TraceRing &ring(char stage);
+
+    void write(char stage, const TraceEvent *events, int count);
+
+private:
+    std::ofstream out_;
+    std::vector<char> buf_;
+    std::map<char, std::unique_ptr<TraceRing>> rings_;
+
+    void putWord(uint64_t w, int nbytes);
+};
+
+// Reads back a trace file
+//
+class TraceReader {
+public:
+    TraceReader(const std::string &fname);
+
+    int getSampleRate() const { return sampleRate_; }
+    uint64_t getStartSample() const { return startSample_; }
+
+    bool next(TraceEvent &ev);
+
+private:
+    std::ifstream in_;
+    int sampleRate_;
+    uint64_t startSample_;
+    std::vector<char> buf_;
+    size_t bufIdx_;
+
+    uint64_t getWord(int nbytes);
+};
+
+#endif
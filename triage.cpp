@@ -0,0 +1,214 @@
+#include "triage.h"
+
+#include "bandtrk.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+using std::endl;
+using std::ostream;
+using std::vector;
+
+using Span = SpanSource::Span;
+
+namespace {
+    // A span of mark or space at least this many bit clocks long (one
+    // and a half bits at 1200 baud) is signal rather than a stray cycle
+    // or two of noise. GAP seconds without one ends a record, and a
+    // record shorter than MIN_RECORD seconds is just a burst of noise.
+    //
+    const double SOLID = 0.375;
+    const double GAP = 1.0;
+    const double MIN_RECORD = 0.5;
+
+    const double FULL_SCALE = 32768.0;
+
+    // a level as a fraction of full scale, in dB
+    double dB(double level)
+    {
+        return level > 0 ? std::max(-120.0, 20 * std::log10(level / FULL_SCALE)) : -120.0;
+    }
+}
+
+TriageReport::TriageReport(SampleSource &source, int dcwin, DCFilter::Mode mode, bool negate, int window)
+    : tap_(source, seconds_)
+    , fused_(tap_, dcwin, mode, negate, window)
+    , inRecord_(false)
+    , recordStart_(0)
+    , lastSolid_(0)
+{
+    fused_.adapt();
+}
+
+// Read the whole capture
+void TriageReport::run()
+{
+    while (true) {
+        vector<Span> spans = fused_.getSpans(1024);
+        if (spans.empty()) {
+            break;
+        }
+
+        for (auto &span : spans) {
+            addSpan(span);
+        }
+    }
+
+    if (inRecord_) {
+        endRecord();
+    }
+}
+
+// Print a line for each second, then the records, then the summary
+void TriageReport::report(ostream &out) const
+{
+    std::streamsize precision = out.precision(3);
+
+    double speedTime = 0;
+    double speedSum = 0;
+
+    for (size_t i = 0; i < seconds_.size(); i++) {
+        const Second &s = seconds_[i];
+
+        double n = std::max<uint32_t>(s.samples, 1);
+        double mean = s.sum / n;
+        double rms = std::sqrt(std::max(0.0, s.sumSquares / n - mean * mean));
+        double spans = std::max(s.time[SpanSource::Space] + s.time[SpanSource::Mark] + s.time[SpanSource::Noise], 1e-9);
+
+        out
+            << "second " << i
+            << " level " << dB(rms)
+            << " peak " << dB(s.peak)
+            << " dc " << mean / FULL_SCALE
+            << " mark " << s.time[SpanSource::Mark] / spans
+            << " space " << s.time[SpanSource::Space] / spans
+            << " noise " << s.time[SpanSource::Noise] / spans;
+        if (s.speedTime > 0) {
+            out << " speed " << s.speedSum / s.speedTime;
+        } else {
+            out << " speed -";
+        }
+        out << endl;
+
+        speedTime += s.speedTime;
+        speedSum += s.speedSum;
+    }
+
+    out.precision(precision);
+
+    for (auto &record : records_) {
+        out << "record " << record.start << " " << record.end << endl;
+    }
+
+    double seconds = double(getSampleCount()) / tap_.getSampleRate();
+    out
+        << "seconds " << seconds << endl
+        << "records " << records_.size() << endl
+        << "carrier " << (seconds > 0 ? speedTime / seconds : 0) << endl;
+    if (speedTime > 0) {
+        out << "speed " << speedSum / speedTime << endl;
+    }
+}
+
+// Count a span towards the seconds it covers, and look for the ends of
+// records
+void TriageReport::addSpan(const Span &span)
+{
+    double end = span.start + span.length;
+    double speed = 1.0 / (BandTracker::BAUD_RATE * span.clock);
+
+    for (double t = span.start; t < end; ) {
+        size_t sec = size_t(t);
+        if (seconds_.size() <= sec) {
+            seconds_.resize(sec + 1);
+        }
+
+        double next = std::min(end, double(sec + 1));
+        Second &s = seconds_[sec];
+        s.time[span.value] += next - t;
+        if (span.value != SpanSource::Noise) {
+            s.speedTime += next - t;
+            s.speedSum += (next - t) * speed;
+        }
+        t = next;
+    }
+
+    if (span.value != SpanSource::Noise && span.length >= SOLID * span.clock) {
+        if (!inRecord_) {
+            inRecord_ = true;
+            recordStart_ = span.start;
+        }
+        lastSolid_ = end;
+    } else if (inRecord_ && end - lastSolid_ >= GAP) {
+        endRecord();
+    }
+}
+
+// End the record in progress at the last solid span
+void TriageReport::endRecord()
+{
+    if (lastSolid_ - recordStart_ >= MIN_RECORD) {
+        records_.push_back(Record{ recordStart_, lastSolid_ });
+    }
+    inRecord_ = false;
+}
+
+TriageReport::LevelTap::LevelTap(SampleSource &src, vector<Second> &seconds)
+    : src_(src)
+    , seconds_(seconds)
+    , rate_(src.getSampleRate())
+    , pos_(0)
+{
+}
+
+void TriageReport::LevelTap::skip(uint32_t nsamples)
+{
+    src_.skip(nsamples);
+    pos_ += nsamples;
+}
+
+// Pass on a block of samples, adding up their level in each second they
+// cover. The loop over a second's samples is simple enough for the
+// compiler to vectorize.
+//
+vector<int16_t> TriageReport::LevelTap::readSamples(uint32_t nsamples)
+{
+    vector<int16_t> samples = src_.readSamples(nsamples);
+    const int16_t *p = samples.data();
+    size_t left = samples.size();
+
+    while (left) {
+        size_t sec = pos_ / rate_;
+        if (seconds_.size() <= sec) {
+            seconds_.resize(sec + 1);
+        }
+
+        size_t n = std::min<uint64_t>(left, (sec + 1) * rate_ - pos_);
+        int64_t sum = 0;
+        int64_t sumSquares = 0;
+        int32_t lo = 0;
+        int32_t hi = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            int32_t x = p[i];
+            sum += x;
+            sumSquares += x * x;
+            lo = std::min(lo, x);
+            hi = std::max(hi, x);
+        }
+
+        Second &s = seconds_[sec];
+        s.samples += n;
+        s.sum += sum;
+        s.sumSquares += sumSquares;
+        s.peak = std::max(s.peak, std::max(hi, -lo));
+
+        p += n;
+        left -= n;
+        pos_ += n;
+    }
+
+    return samples;
+}
@@ -0,0 +1,75 @@
+#ifndef TRIAGE_H
+#define TRIAGE_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include "dcfilter.h"
+#include "fused.h"
+#include "stage.h"
+
+// A quick look at a capture without decoding it, to tell which captures
+// hold data and how clean it is. The samples are read once: their level
+// is measured on the way into the fused front end, which sorts cycles
+// into marks, spaces and noise and tracks the tape speed, and that's as
+// far as the chain goes. What's found is reported for each second, with
+// the records on the tape and a summary to rank captures by.
+//
+class TriageReport {
+public:
+    TriageReport(SampleSource &source, int dcwin, DCFilter::Mode mode, bool negate, int window = 4096);
+
+    void run();
+    void report(std::ostream &out) const;
+
+    uint64_t getSampleCount() const { return fused_.getSampleCount(); }
+
+private:
+    // what was found in one second of the capture
+    struct Second {
+        uint32_t samples;
+        int64_t sum;
+        int64_t sumSquares;
+        int peak;
+        double time[3];     // seconds of space, mark and noise
+        double speedTime;   // of mark and space, over which speed is averaged
+        double speedSum;
+    };
+
+    // Measures the level of the raw samples as they pass through
+    class LevelTap : public SampleSource {
+    public:
+        LevelTap(SampleSource &src, std::vector<Second> &seconds);
+
+        int getSampleRate() const override { return src_.getSampleRate(); }
+        void skip(uint32_t nsamples) override;
+        std::vector<int16_t> readSamples(uint32_t nsamples) override;
+
+    private:
+        SampleSource &src_;
+        std::vector<Second> &seconds_;
+        uint32_t rate_;
+        uint64_t pos_;
+    };
+
+    // a stretch of signal between gaps
+    struct Record {
+        double start;
+        double end;
+    };
+
+    std::vector<Second> seconds_;
+    LevelTap tap_;
+    FusedFrontEnd fused_;
+
+    std::vector<Record> records_;
+    bool inRecord_;
+    double recordStart_;
+    double lastSolid_;
+
+    void addSpan(const SpanSource::Span &span);
+    void endRecord();
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include "tune.h"
+
+#include "memsrc.h"
+#include "stage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using std::endl;
+using std::ifstream;
+using std::map;
+using std::ofstream;
+using std::ostream;
+using std::runtime_error;
+using std::string;
+using std::stringstream;
+using std::vector;
+
+namespace {
+    // The stages in the order they're tuned, from the samples down
+    const char STAGES[] = "zfnbco";
+
+    // Sizes tried are the powers of two from MIN_BLOCK to MAX_BLOCK, so
+    // long as a block fits in L2_SHARE of the L2 cache (several stages'
+    // blocks are in use at once.) Each is timed over REPS decodes, keeping
+    // the fastest, and only replaces the size before it if it's faster by
+    // more than MARGIN, so timing jitter doesn't move things around.
+    //
+    const int MIN_BLOCK = 16;
+    const int MAX_BLOCK = 65536;
+    const double L2_SHARE = 0.25;
+    const int REPS = 3;
+    const double MARGIN = 0.02;
+
+    // The synthesized tape: the tones and the leader before the listing,
+    // and a little noise so the noise stages have something to do
+    const double MARK_FREQ = 2400.0;
+    const double SPACE_FREQ = 1200.0;
+    const double LEADER = 2.0;
+    const double LEVEL = 8000.0;
+    const int NOISE = 400;
+    const double PI = 3.14159265358979323846;
+
+    // Roughly how many bytes one item of each stage's block takes: a
+    // sample, a crossing time, a span, a bit and its time, or a character
+    // and its position.
+    //
+    size_t itemBytes(char stage)
+    {
+        switch (stage) {
+        case 'z': return sizeof(int16_t);
+        case 'f': return sizeof(double);
+        case 'n':
+        case 'b': return sizeof(SpanSource::Span);
+        case 'c': return sizeof(double);
+        default:  return 1 + 2 * sizeof(double);
+        }
+    }
+
+    long cacheSize(int name)
+    {
+        long size = sysconf(name);
+        return size > 0 ? size : 0;
+    }
+}
+
+BlockTuner::BlockTuner(vector<int16_t> samples, int sampleRate, const DecodeOptions &opts)
+    : samples_(std::move(samples))
+    , sampleRate_(sampleRate)
+    , opts_(opts)
+    , blocks_(opts.blocks)
+    , defaultSeconds_(0)
+    , tunedSeconds_(0)
+{
+}
+
+// Encode lines of BASIC as they'd be saved, each character with a start
+// bit, eight data bits LSB first and two stop bits, after some leader
+vector<int16_t> BlockTuner::synthesize(int sampleRate, double seconds, const DecodeOptions &opts)
+{
+    int baud = opts.baud ? opts.baud : 300;
+    double bitLength = double(sampleRate) / baud;
+    size_t total = size_t(seconds * sampleRate);
+
+    vector<int16_t> samples;
+    samples.reserve(total);
+
+    double phase = 0;
+    double bitEnd = 0;
+    uint32_t rng = 1;
+
+    auto bit = [&](bool mark) {
+        double step = 2 * PI * (mark ? MARK_FREQ : SPACE_FREQ) / sampleRate;
+        bitEnd += bitLength;
+        while (samples.size() < bitEnd && samples.size() < total) {
+            rng = rng * 1103515245 + 12345;
+            int noise = int((rng >> 16) % (2 * NOISE + 1)) - NOISE;
+            samples.push_back(int16_t(LEVEL * std::sin(phase) + noise));
+            phase = std::fmod(phase + step, 2 * PI);
+        }
+    };
+
+    while (bitEnd < LEADER * sampleRate) {
+        bit(true);
+    }
+
+    for (int line = 10; samples.size() < total; line += 10) {
+        stringstream ss;
+        ss << line << " PRINT \"HELLO WORLD " << line * 7 % 1000 << "\"\r\n";
+
+        for (char ch : ss.str()) {
+            bit(false);
+            for (int i = 0; i < 8; i++) {
+                bit((ch >> i) & 1);
+            }
+            bit(true);
+            bit(true);
+        }
+    }
+
+    return samples;
+}
+
+// Time the chain with the block sizes given, then try each stage's sizes
+// in turn with the best found so far for the others
+void BlockTuner::run(ostream &log)
+{
+    defaultSeconds_ = time(blocks_);
+    tunedSeconds_ = defaultSeconds_;
+
+    for (const char *stage = STAGES; *stage; stage++) {
+        for (int size : candidates(*stage)) {
+            if (size == blocks_[*stage]) {
+                continue;
+            }
+
+            map<char, int> trial = blocks_;
+            trial[*stage] = size;
+            double seconds = time(trial);
+            log << *stage << "=" << size << " " << seconds << endl;
+
+            if (seconds < tunedSeconds_ * (1 - MARGIN)) {
+                tunedSeconds_ = seconds;
+                blocks_ = trial;
+            }
+        }
+    }
+}
+
+// The fastest of several decodes of the clip, in seconds
+double BlockTuner::time(const map<char, int> &blocks)
+{
+    DecodeOptions opts = opts_;
+    opts.blocks = blocks;
+
+    double best = 0;
+    for (int i = 0; i < REPS; i++) {
+        MemorySource source{ samples_, sampleRate_ };
+        Decoder decoder{ source, opts };
+
+        auto startTime = std::chrono::steady_clock::now();
+        decoder.run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+        if (i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+
+    return best;
+}
+
+// The sizes to try for a stage
+vector<int> BlockTuner::candidates(char stage) const
+{
+    size_t limit = size_t(L2_SHARE * cacheSize(_SC_LEVEL2_CACHE_SIZE));
+
+    vector<int> sizes;
+    for (int size = MIN_BLOCK; size <= MAX_BLOCK; size *= 2) {
+        if (limit && size * itemBytes(stage) > limit && !sizes.empty()) {
+            break;
+        }
+        sizes.push_back(size);
+    }
+    return sizes;
+}
+
+string BlockTuner::configPath()
+{
+    if (const char *path = getenv("OSIWAVE_CONFIG")) {
+        return path;
+    }
+    if (const char *home = getenv("HOME")) {
+        return string{ home } + "/.osiwave";
+    }
+    return "";
+}
+
+// The file has a line for each setting, a name and a value: the L1 data
+// and L2 cache sizes in bytes, then the block size for each stage letter
+bool BlockTuner::load(const string &path, map<char, int> &blocks)
+{
+    ifstream in{ path };
+    if (!in) {
+        return false;
+    }
+
+    map<char, int> found;
+    long l1 = -1;
+    long l2 = -1;
+    string line;
+
+    for (int lineno = 1; std::getline(in, line); lineno++) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        stringstream ss{ line };
+        string name;
+        long value;
+        if (!(ss >> name >> value) || value < 0 || (value == 0 && name.size() == 1)) {
+            throw runtime_error{ "bad line " + std::to_string(lineno) + "." };
+        }
+
+        if (name == "l1") {
+            l1 = value;
+        } else if (name == "l2") {
+            l2 = value;
+        } else if (name.size() == 1 && blocks.find(name[0]) != blocks.end()) {
+            found[name[0]] = int(value);
+        } else {
+            throw runtime_error{ "unknown setting `" + name + "' on line " + std::to_string(lineno) + "." };
+        }
+    }
+
+    if (l1 != cacheSize(_SC_LEVEL1_DCACHE_SIZE) || l2 != cacheSize(_SC_LEVEL2_CACHE_SIZE)) {
+        return false;
+    }
+
+    for (auto &block : found) {
+        blocks[block.first] = block.second;
+    }
+    return true;
+}
+
+void BlockTuner::save(const string &path, const map<char, int> &blocks)
+{
+    ofstream out{ path, std::ios::trunc };
+
+    out
+        << "# block sizes found by osiwave -A" << endl
+        << "l1 " << cacheSize(_SC_LEVEL1_DCACHE_SIZE) << endl
+        << "l2 " << cacheSize(_SC_LEVEL2_CACHE_SIZE) << endl;
+    for (auto &block : blocks) {
+        out << block.first << " " << block.second << endl;
+    }
+
+    if (!out) {
+        throw runtime_error{ "failed writing configuration." };
+    }
+}
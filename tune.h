@@ -0,0 +1,58 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+
+// Finds the block sizes the decode chain runs fastest with on this
+// machine. A clip is decoded over and over from memory, trying a range
+// of sizes for each stage in turn and keeping whichever is fastest; the
+// sizes tried stop where a block would no longer fit in the L2 cache.
+//
+// The sizes found are kept in a small configuration file which later
+// runs read, along with the cache sizes they were found for, so a file
+// shared between machines is only used on the one it suits.
+//
+class BlockTuner {
+public:
+    BlockTuner(std::vector<int16_t> samples, int sampleRate, const DecodeOptions &opts);
+
+    // a tape of `seconds' seconds of program listing, at the baud rate in
+    // `opts', to tune on when there's no capture to hand
+    static std::vector<int16_t> synthesize(int sampleRate, double seconds, const DecodeOptions &opts);
+
+    void run(std::ostream &log);
+
+    const std::map<char, int> &getBlocks() const { return blocks_; }
+    double getDefaultSeconds() const { return defaultSeconds_; }
+    double getTunedSeconds() const { return tunedSeconds_; }
+
+    // Where the configuration is kept: $OSIWAVE_CONFIG, or .osiwave in the
+    // home directory. Empty if there's neither.
+    //
+    static std::string configPath();
+
+    // Read block sizes from the configuration into `blocks'. Returns false
+    // if there's no configuration, or it was made for different caches.
+    //
+    static bool load(const std::string &path, std::map<char, int> &blocks);
+    static void save(const std::string &path, const std::map<char, int> &blocks);
+
+private:
+    std::vector<int16_t> samples_;
+    int sampleRate_;
+    DecodeOptions opts_;
+    std::map<char, int> blocks_;
+    double defaultSeconds_;
+    double tunedSeconds_;
+
+    double time(const std::map<char, int> &blocks);
+    std::vector<int> candidates(char stage) const;
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "wave.h"
 
+#include "hash.h"
+
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -12,31 +15,61 @@ using std::ios_base;
 using std::endl;
 using std::ifstream;
 using std::ios;
+using std::lock_guard;
+using std::mutex;
 using std::ofstream;
 using std::runtime_error;
 using std::stringstream;
 using std::string;
+using std::unique_lock;
 using std::vector;
 
+using Clock = std::chrono::steady_clock;
+using Seconds = std::chrono::duration<double>;
+
 const int PCM_TAG = 1;
 
-// Open the file and verify the format
+// Size of each read-ahead buffer
+const uint32_t READ_AHEAD_BLOCK = 256 * 1024;
+
+// Open the file and verify the format. A file name of `-' reads the 
+// wave data from stdin, for decoding live.
 //
 WaveReader::WaveReader(const string &fname)
     : sampleRate_(44100)
     , nchannels_(1)
     , readChan_(0)
+    , streaming_(fname == "-")
+    , dataStart_(0)
     , endOfData_(0)
+    , pos_(0)
+    , ioWaitSeconds_(0)
+    , depth_(0)
+    , currentIdx_(0)
+    , readAheadDone_(false)
+    , stopReadAhead_(false)
 {
     const string badFile = "file is not a wave file.";
 
-    in_.open(fname, ios::binary|ios::ate);
+    uint64_t fileSize = UINT64_MAX;
+
+    if (streaming_) {
+        in_.open("/dev/stdin", ios::binary);
+    } else {
+        in_.open(fname, ios::binary|ios::ate);
+    }
     if (!in_) {
         throw runtime_error{ "failed to open file." };
     }
 
-    auto fileSize = in_.tellg();
-    in_.seekg(0);
+    if (!streaming_) {
+        fileSize = in_.tellg();
+        in_.seekg(0);
+    }
+
+    // count the header bytes ourselves since a stream can't tell us 
+    // where we are
+    uint32_t pos = 12;
 
     if (readFourCC() != "RIFF") {
         throw runtime_error{ badFile };
@@ -47,13 +80,12 @@ WaveReader::WaveReader(const string &fname)
     // riffChunkSize is how many bytes is in the WAVE chunk, less the
     // 8 bytes for RIFF and the following uint32.
     //
-    if (riffChunkSize + 8 > fileSize || riffChunkSize < 4 || readFourCC() != "WAVE") {
+    if (uint64_t{ riffChunkSize } + 8 > fileSize || riffChunkSize < 4 || readFourCC() != "WAVE") {
         throw runtime_error{ badFile };
     }
 
     uint32_t left = riffChunkSize - 4;
-
-    uint32_t dataStart = 0;
+    bool haveData = false;
 
     // walk the chunks
     //
@@ -61,15 +93,27 @@ WaveReader::WaveReader(const string &fname)
         string fcc = readFourCC();
         uint32_t len = readUnsignedWord(4);
         left -= 8;
+        pos += 8;
 
         if (len > left) {
-            throw runtime_error{ badFile };
+            // a stream doesn't know how much data is coming
+            if (!streaming_ || fcc != "data") {
+                throw runtime_error{ badFile };
+            }
+            len = left;
         }
         left -= len;
 
         if (fcc == "data") {
-            dataStart = in_.tellg();
-            endOfData_ = dataStart + len;
+            haveData = true;
+            dataStart_ = pos;
+            endOfData_ = dataStart_ + len;
+
+            if (streaming_) {
+                break;
+            }
+            in_.seekg(len, ios_base::cur);
+            pos += len;
             continue;
         }
 
@@ -93,15 +137,83 @@ WaveReader::WaveReader(const string &fname)
             if (formatTag != PCM_FORMAT || bitsPerSample != 16) {
                 throw runtime_error{ "wave format must be 16-bit PCM." };
             }
+
+            len -= 16;
+            pos += 16;
         }
+
+        // skip anything we don't understand
+        in_.ignore(len);
+        pos += len;
     }
 
-    if (dataStart == 0) {
+    if (!haveData) {
         // we never found a data chunk
         throw runtime_error{ badFile };
     }
     
-    in_.seekg(dataStart);
+    if (!streaming_) {
+        in_.seekg(dataStart_);
+    }
+    pos_ = dataStart_;
+}
+
+// Stop the read-ahead thread, if there is one
+//
+WaveReader::~WaveReader()
+{
+    if (readAhead_.joinable()) {
+        {
+            lock_guard<mutex> lock{ mutex_ };
+            stopReadAhead_ = true;
+        }
+        cv_.notify_all();
+        readAhead_.join();
+    }
+}
+
+// Return the number of samples (per channel) in the data chunk.
+//
+uint32_t WaveReader::getSampleCount() const
+{
+    return (endOfData_ - dataStart_) / (sizeof(int16_t) * nchannels_);
+}
+
+// Return a hash of the entire data chunk and the channel being read. The
+// current read position is preserved. Must be called before read-ahead
+// is started.
+//
+uint64_t WaveReader::hashData()
+{
+    const uint32_t CHUNK = 1 << 20;
+
+    if (streaming_) {
+        throw runtime_error{ "cannot hash a stream." };
+    }
+
+    auto pos = in_.tellg();
+    in_.seekg(dataStart_);
+
+    // the same bytes decode differently with another layout or channel
+    Hash64 hash;
+    int32_t layout[2] = { nchannels_, readChan_ };
+    hash.update(layout, sizeof(layout));
+
+    vector<char> buf(CHUNK);
+    uint32_t left = endOfData_ - dataStart_;
+
+    while (left) {
+        uint32_t n = std::min(left, CHUNK);
+        in_.read(buf.data(), n);
+        if (in_.fail()) {
+            throw runtime_error{ "failed reading samples from stream." };
+        }
+        hash.update(buf.data(), n);
+        left -= n;
+    }
+
+    in_.seekg(pos);
+    return hash.digest();
 }
 
 // Skip ahead in the stream by the given number of samples.
@@ -111,7 +223,21 @@ void WaveReader::skip(uint32_t nsamples)
     int stride = sizeof(int16_t) * nchannels_;
     uint32_t nbytes = nsamples * stride;
 
-    in_.seekg(nbytes, ios_base::cur);
+    if (depth_) {
+        while (nbytes && readAheadBytes(std::min(nbytes, READ_AHEAD_BLOCK))) {
+            nbytes -= std::min(nbytes, READ_AHEAD_BLOCK);
+        }
+        return;
+    }
+
+    nbytes = std::min(nbytes, endOfData_ - pos_);
+
+    if (streaming_) {
+        in_.ignore(nbytes);
+    } else {
+        in_.seekg(nbytes, ios_base::cur);
+    }
+    pos_ += nbytes;
 }
 
 // Sets the read channel, which is zero based. If the stream is stereo,
@@ -133,6 +259,20 @@ void WaveReader::setReadChannel(int chan)
     readChan_ = chan;
 }
 
+// Start reading the rest of the data chunk in a background thread, 
+// keeping up to `depth' blocks read ahead of the decoder. Once this 
+// has been called, the reader thread owns the file.
+//
+void WaveReader::startReadAhead(int depth)
+{
+    if (depth_ || depth <= 0) {
+        return;
+    }
+
+    depth_ = depth;
+    readAhead_ = std::thread{ &WaveReader::readAheadThread, this };
+}
+
 // Reads a block of samples of size `nsamples'. Fewer samples may
 // be returned. After all samples have been read, an empty vector
 // will be returned.
@@ -142,36 +282,174 @@ vector<int16_t> WaveReader::readSamples(uint32_t nsamples)
     vector<int16_t> data;
 
     int stride = sizeof(int16_t) * nchannels_;
-    uint32_t nbytes = nsamples * stride;
-    uint32_t left = endOfData_ - in_.tellg();
+    uint32_t nbytes = readBytes(nsamples * stride);
 
-    if (left == 0) {
+    if (nbytes == 0) {
         return data;
     }
 
+    nsamples = nbytes / stride;
+    data.reserve(nsamples);
+
+    int offs = sizeof(int16_t) * readChan_;
+
+    for (uint32_t i = 0; i < nsamples; i++) {
+        uint16_t lo = readBuf_[i * stride + offs] & 0xff;
+        uint16_t hi = readBuf_[i * stride + offs + 1] & 0xff;
+        data.push_back(static_cast<int16_t>((hi << 8) | lo));
+    }
+
+    return data;
+}
+
+// Read up to `nbytes' bytes of sample data into readBuf_, either
+// directly or from the read-ahead buffers. Returns the number of
+// bytes read.
+//
+uint32_t WaveReader::readBytes(uint32_t nbytes)
+{
+    if (depth_) {
+        return readAheadBytes(nbytes);
+    }
+
+    uint32_t left = endOfData_ - pos_;
+
+    if (left == 0) {
+        return 0;
+    }
+
     nbytes = std::min(nbytes, left);
 
     if (readBuf_.size() < nbytes) {
         readBuf_.resize(nbytes);
     }
 
-    in_.read(readBuf_.data(), nbytes);
+    auto start = Clock::now();
+    nbytes = readData(readBuf_.data(), nbytes);
+    ioWaitSeconds_ += Seconds{ Clock::now() - start }.count();
+
+    return nbytes;
+}
+
+// Read sample data from the file. A stream may end before the end of the
+// data chunk its header promised, so that's not an error.
+//
+uint32_t WaveReader::readData(char *buf, uint32_t nbytes)
+{
+    in_.read(buf, nbytes);
     if (in_.fail()) {
-        throw runtime_error{ "failed reading samples from stream." };
+        if (!streaming_ || !in_.eof()) {
+            throw runtime_error{ "failed reading samples from stream." };
+        }
+
+        nbytes = in_.gcount();
+        endOfData_ = pos_ + nbytes;
     }
 
-    nsamples = nbytes / stride;
-    data.reserve(nsamples);
+    pos_ += nbytes;
+    return nbytes;
+}
 
-    int offs = sizeof(int16_t) * readChan_;
+// Read up to `nbytes' from the blocks the reader thread has queued,
+// waiting for it if need be.
+//
+uint32_t WaveReader::readAheadBytes(uint32_t nbytes)
+{
+    if (readBuf_.size() < nbytes) {
+        readBuf_.resize(nbytes);
+    }
 
-    for (uint32_t i = 0; i < nsamples; i++) {
-        uint16_t lo = readBuf_[i * stride + offs] & 0xff;
-        uint16_t hi = readBuf_[i * stride + offs + 1] & 0xff;
-        data.push_back(static_cast<int16_t>((hi << 8) | lo));
+    uint32_t got = 0;
+
+    while (got < nbytes) {
+        if (currentIdx_ == current_.size()) {
+            unique_lock<mutex> lock{ mutex_ };
+
+            if (current_.capacity()) {
+                empty_.push_back(std::move(current_));
+                current_.clear();
+                currentIdx_ = 0;
+            }
+
+            if (full_.empty() && !readAheadDone_) {
+                auto start = Clock::now();
+                cv_.wait(lock, [this]() { return !full_.empty() || readAheadDone_; });
+                ioWaitSeconds_ += Seconds{ Clock::now() - start }.count();
+            }
+
+            if (full_.empty()) {
+                if (!readAheadError_.empty()) {
+                    throw runtime_error{ readAheadError_ };
+                }
+                current_.clear();
+                break;
+            }
+
+            current_ = std::move(full_.front());
+            full_.pop_front();
+            currentIdx_ = 0;
+            cv_.notify_all();
+        }
+
+        uint32_t n = std::min<size_t>(nbytes - got, current_.size() - currentIdx_);
+        std::copy(current_.begin() + currentIdx_, current_.begin() + currentIdx_ + n, readBuf_.begin() + got);
+        currentIdx_ += n;
+        got += n;
     }
 
-    return data;
+    return got;
+}
+
+// The body of the read-ahead thread. Keeps up to depth_ full buffers
+// queued, recycling the ones the decoder is done with.
+//
+void WaveReader::readAheadThread()
+{
+    while (true) {
+        vector<char> buf;
+
+        {
+            unique_lock<mutex> lock{ mutex_ };
+            cv_.wait(lock, [this]() { return stopReadAhead_ || full_.size() < static_cast<size_t>(depth_); });
+            if (stopReadAhead_) {
+                return;
+            }
+
+            if (!empty_.empty()) {
+                buf = std::move(empty_.back());
+                empty_.pop_back();
+            }
+        }
+
+        uint32_t n = std::min(READ_AHEAD_BLOCK, endOfData_ - pos_);
+        string error;
+
+        if (n) {
+            buf.resize(n);
+            try {
+                n = readData(buf.data(), n);
+                buf.resize(n);
+            } catch (runtime_error re) {
+                error = re.what();
+                n = 0;
+            }
+        }
+
+        {
+            lock_guard<mutex> lock{ mutex_ };
+            if (n == 0) {
+                readAheadDone_ = true;
+                readAheadError_ = error;
+            } else {
+                full_.push_back(std::move(buf));
+            }
+        }
+        cv_.notify_all();
+
+        if (n == 0) {
+            return;
+        }
+    }
 }
 
 
@@ -1,29 +1,65 @@
 #ifndef WAVE_H
 #define WAVE_H
 
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
-class WaveReader {
+#include "audio.h"
+
+class WaveReader : public AudioReader {
 public:
     WaveReader(const std::string &fname);
+    ~WaveReader();
+
+    int getSampleRate() const override { return sampleRate_; }
+    int getChannels() const override { return nchannels_; }
+    bool isStreaming() const override { return streaming_; }
+    uint32_t getSampleCount() const override;
+
+    uint64_t hashData() override;
 
-    int getSampleRate() const { return sampleRate_; }
-    int getChannels() const { return nchannels_; }
+    void skip(uint32_t nsamples) override;
+    void setReadChannel(int chan) override;
+    void startReadAhead(int depth) override;
+    std::vector<int16_t> readSamples(uint32_t nsamples) override;
 
-    void skip(uint32_t nsamples);
-    void setReadChannel(int chan);
-    std::vector<int16_t> readSamples(uint32_t nsamples);
+    double getIoWaitSeconds() const override { return ioWaitSeconds_; }
 
 private:
     int sampleRate_;
     int nchannels_;
     int readChan_;
+    bool streaming_;
     std::ifstream in_;
+    uint32_t dataStart_;
     uint32_t endOfData_;
     std::vector<char> readBuf_;
+    uint32_t pos_;
+    double ioWaitSeconds_;
+
+    // read-ahead state, shared with the reader thread
+    std::thread readAhead_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int depth_;
+    std::deque<std::vector<char>> full_;
+    std::vector<std::vector<char>> empty_;
+    std::vector<char> current_;
+    size_t currentIdx_;
+    bool readAheadDone_;
+    bool stopReadAhead_;
+    std::string readAheadError_;
+
+    uint32_t readBytes(uint32_t nbytes);
+    uint32_t readData(char *buf, uint32_t nbytes);
+    uint32_t readAheadBytes(uint32_t nbytes);
+    void readAheadThread();
 
     std::string readFourCC();
     uint32_t readUnsignedWord(int nbytes);
@@ -1,123 +1,133 @@
 #include "xcross.h"
 
-#include "dcfilter.h"
+#include "perfctr.h"
+#include "probes.h"
+#include "tracer.h"
 
-#include <iostream>
 #include <vector>
 
-using std::cout;
-using std::endl;
 using std::vector;
 
-ZeroCrossFilter::ZeroCrossFilter(DCFilter &dc, int sampleRate, bool negate)
-    : dc_(dc)
-    , trace_(false)
+ZeroCrossFilter::ZeroCrossFilter(DCFilter &dc, int sampleRate, bool negate, int window)
+    : trace_(nullptr)
+    , flush_(false)
     , negate_(negate)
     , secPerSample_(1.0 / sampleRate)
-    , nextSampleIdx_(0)
-    , sampleTime_(-1)
-    , eof_(false)
+    , samples_(dc, window)
+    , prevSample_(0)
+    , sampleTime_(0)
+    , inRun_(false)
+    , runStart_(0)
 {
-    samples_ = dc_.readSamples(WINDOW);
-    prevSample_ = getNextSample();
 }
 
 // Enable tracing
-void ZeroCrossFilter::trace()
+void ZeroCrossFilter::trace(TraceRing &ring)
 {
-  trace_ = true;
+    trace_ = &ring;
+}
+
+// Return as soon as the buffered samples are used up, rather than
+// waiting for a full block of crossings
+void ZeroCrossFilter::flush()
+{
+    flush_ = true;
 }
 
 // Given sample data, find low-to-high zero crossings and return
 // their sample timestamps, in seconds, from start of stream.
+//
+// Each sample is checked against the one before it, a block of samples
+// at a time. A run of zeroes counts as one crossing in the middle of the
+// run, which is only known once the run is over.
+//
 vector<double> ZeroCrossFilter::getTimestamps(int ncross) 
 {
+    PerfScope scope{ PerfCounters::ZeroCross };
+    OSIWAVE_PROBE1(crossings_entry, ncross);
+
     vector<double> out;
     out.reserve(ncross);
 
-    int l = prevSample_;
-    int r = getNextSample();
+    while (out.size() < ncross) {
+        if (samples_.drained()) {
+            if (flush_ && out.size()) {
+                break;
+            }
+            if (!samples_.refill()) {
+                // a run of zeroes at the very end still counts
+                if (inRun_) {
+                    runCrossing(out, sampleTime_);
+                }
+                break;
+            }
+        }
 
-    if (trace_) {
-        cout << "zero crossings:" << endl;
-    }
+        const int16_t *begin = samples_.begin();
+        const int16_t *end = samples_.end();
+        const int16_t *p = begin;
 
-    while (out.size() < ncross && !eof_) {        
-        // if there are a span of zeroes, put the crossing in the middle
-        if (l == 0) {
-            int zeroes = 1;
-            uint32_t s = sampleTime_ - 1;
+        for (; p != end && out.size() < ncross; p++) {
+            int l = prevSample_;
+            int r = *p;
+            uint64_t k = sampleTime_++;
+            prevSample_ = r;
 
-            while (!eof_ && (l = r) == 0) {
-                r = getNextSample();
-                zeroes++;
+            if (k == 0) {
+                continue;
             }
 
-            double t = secPerSample_ *  (s + zeroes * 0.5);
-            if (trace_) {
-                cout << "  " << s << "  " << t << "(Z)" << endl;
+            if (l == 0) {
+                if (!inRun_) {
+                    inRun_ = true;
+                    runStart_ = k - 1;
+                }
+                continue;
             }
-            out.push_back(t);
 
-            r = getNextSample();
-            continue;
-        }
+            if (inRun_) {
+                runCrossing(out, k - 1);
 
-        bool cross = false;
-        double t = 0;
-        if (negate_) {
-            if (l > 0 && r < 0) {
-                double num = l;
-                double den = l - r;
-                double t = num / den;
-                cross = true;
+                // no room for a crossing in this pair too; look again
+                // next time
+                if (out.size() == ncross) {
+                    prevSample_ = l;
+                    sampleTime_ = k;
+                    break;
+                }
             }
-        } else {
-            if (l < 0 && r > 0) {
-                double num = -l;
-                double den = r - l;
-                t = num / den;
-                cross = true;
+
+            double t;
+            if (negate_ && l > 0 && r < 0) {
+                t = double(l) / double(l - r);
+            } else if (!negate_ && l < 0 && r > 0) {
+                t = double(-l) / double(r - l);
+            } else {
+                continue;
             }
-        }
 
-        if (cross) {
-            t = (sampleTime_ + t) * secPerSample_;
+            t = (k + t) * secPerSample_;
             if (trace_) {
-                cout << "  " << sampleTime_ << "  " << t << "(X)" << endl;
+                trace_->record(TraceEvent::Crossing, t, 0);
             }
-            out.push_back({ t });
+            out.push_back(t);
         }
 
-        l = r;
-        r = getNextSample();
+        samples_.consume(p - begin);
     }
 
-    prevSample_ = r;
-
+    OSIWAVE_PROBE2(crossings_return, ncross, out.size());
     return out;
 }
 
-// Get the buffered next sample
-//
-int ZeroCrossFilter::getNextSample() 
+// End the run of zeroes in progress at sample `end', putting a crossing
+// in the middle of it
+void ZeroCrossFilter::runCrossing(vector<double> &out, uint64_t end)
 {
-    if (eof_) {
-        return 0;
-    }
-    
-    if (nextSampleIdx_ < samples_.size()) {
-        sampleTime_++;
-        return samples_[nextSampleIdx_++];
-    }
-
-    samples_ = dc_.readSamples(WINDOW);
-
-    if (samples_.size() == 0) {
-        eof_ = true;
-        return 0;
+    double t = secPerSample_ * (runStart_ + (end - runStart_) * 0.5);
+    if (trace_) {
+        trace_->record(TraceEvent::Crossing, t, 1);
     }
-    nextSampleIdx_ = 0;
-
-    return getNextSample(); 
+    out.push_back(t);
+    inRun_ = false;
 }
@@ -4,29 +4,35 @@
 #include <cstdint>
 #include <vector>
 
-class DCFilter;
+#include "blockrd.h"
+#include "stage.h"
 
-class ZeroCrossFilter {
+class TraceRing;
+
+class ZeroCrossFilter : public CrossingSource {
 public:
-    ZeroCrossFilter(DCFilter &dc, int sampleRate, bool negate);
+    ZeroCrossFilter(DCFilter &dc, int sampleRate, bool negate, int window = 4096);
 
-    void trace();
-    std::vector<double> getTimestamps(int ncross);
+    void trace(TraceRing &ring);
+    void flush();
+    std::vector<double> getTimestamps(int ncross) override;
 
 private:
-    const uint32_t WINDOW = 4096;
-
-    DCFilter& dc_;
-    bool trace_;
+    TraceRing *trace_;
+    bool flush_;
     bool negate_;
     double secPerSample_;
-    std::vector<int16_t> samples_;
-    int nextSampleIdx_;
-    uint32_t sampleTime_;
-    bool eof_;
+    BlockReader<DCFilter> samples_;
+
+    // the sample before the next one, and the next one's index
     int prevSample_;
+    uint64_t sampleTime_;
+
+    // where the run of zeroes in progress, if any, started
+    bool inRun_;
+    uint64_t runStart_;
 
-    int getNextSample();
+    void runCrossing(std::vector<double> &out, uint64_t end);
 };
 
 #endif